@@ -1,7 +1,6 @@
 //Used for local development use
 const localDevelopment = false;
 
-// Exception for german umlaute, replaces ä, ö, ü with unused unicode characters #, $, %
 const form = document.getElementById('form');
 form.onsubmit = function () {
 	var containerSubmit = document.getElementById('containerSubmit');
@@ -23,12 +22,6 @@ form.onsubmit = function () {
 		return false;
 	}
 	else {
-		var r = document.getElementById('inputText').value;
-		r = r.replace(/ä/gi, '$');
-		r = r.replace(/ö/gi, '&');
-		r = r.replace(/ü/gi, '#');
-		document.getElementById('inputText').value = r;
-
 		//Set the hidden date time to UNIX
 		var currentScheduledDateTimeText = document.getElementById('inputScheduledDateTime').value;
 
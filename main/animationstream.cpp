@@ -0,0 +1,164 @@
+#include "animationstream.hpp"
+#include "esp_log.h"
+#include "jsonwriter.hpp"
+#include "keyframes.hpp"
+#include <esp_pthread.h>
+#include <sys/socket.h>
+
+static const char *TAG = "ANIMATION";
+
+AnimationStream::AnimationStream(DisplayManager &displayManager)
+    : _displayManager(displayManager) {
+
+}
+
+AnimationStream::~AnimationStream() {
+    if (_readerThread.joinable())
+        _readerThread.join();
+    if (_keyframes != nullptr)
+        vQueueDelete(_keyframes);
+}
+
+bool AnimationStream::readHeader(httpd_req_t *request) {
+    if (request->content_len < keyframeHeaderLength)
+        return false;
+
+    uint8_t header[keyframeHeaderLength];
+    size_t length = 0;
+    while (length < keyframeHeaderLength) {
+        int received = httpd_req_recv(request, (char *)&header[length], keyframeHeaderLength - length);
+        if (received == HTTPD_SOCK_ERR_TIMEOUT)
+            continue;
+        if (received <= 0)
+            return false;
+        length += received;
+    }
+
+    if (!decodeKeyframeHeader(header, _unitsCount))
+        return false;
+
+    _remaining = request->content_len - keyframeHeaderLength;
+    return _remaining % getKeyframeLength(_unitsCount) == 0;
+}
+
+bool AnimationStream::start(httpd_req_t *request) {
+    if (_busy.load())
+        return false;
+
+    // Only made when first needed, it's a few KB with lots of units
+    if (_keyframes == nullptr)
+        _keyframes = xQueueCreate(queueLength, sizeof(Keyframe_t));
+    if (_keyframes == nullptr)
+        return false;
+
+    // Anything left from a stream the display gave up on
+    xQueueReset(_keyframes);
+    if (!_displayManager.playAnimation(_keyframes))
+        return false;
+
+    if (httpd_req_async_handler_begin(request, &_request) != ESP_OK) {
+        Keyframe_t end = {};
+        end.end = true;
+        xQueueSend(_keyframes, &end, 0);
+        return false;
+    }
+
+    // The last reader has finished, as it clears busy last thing
+    if (_readerThread.joinable())
+        _readerThread.join();
+
+    _busy = true;
+    auto cfg = esp_pthread_get_default_config();
+    cfg.thread_name = "Animation";
+    cfg.stack_size = 1024 * 4;
+    cfg.prio = 5;
+    esp_pthread_set_cfg(&cfg);
+    _readerThread = std::thread(&AnimationStream::reader, this);
+    return true;
+}
+
+void AnimationStream::reader() {
+    ESP_LOGI(TAG, "Streaming %d keyframes", (int)(_remaining / getKeyframeLength(_unitsCount)));
+
+    // Otherwise a read waits out the server's whole receive timeout, put back after for the connection's next request
+    int socket = httpd_req_to_sockfd(_request);
+    struct timeval serverTimeout = {};
+    socklen_t timeoutLength = sizeof(serverTimeout);
+    bool timeoutSet = getsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &serverTimeout, &timeoutLength) == 0;
+    if (timeoutSet) {
+        struct timeval timeout = { .tv_sec = waitMs / 1000, .tv_usec = (waitMs % 1000) * 1000 };
+        timeoutSet = setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0;
+    }
+
+    uint8_t data[keyframeMaxLength];
+    Keyframe_t keyframe = {};
+    int count = 0;
+    bool ok = true;
+    while (ok && _remaining > 0) {
+        ok = receive(data, getKeyframeLength(_unitsCount));
+        if (!ok)
+            break;
+
+        decodeKeyframe(data, _unitsCount, keyframe.holdMs, keyframe.targets, keyframe.stepIntervals, CONFIG_UNITS_COUNT);
+        ok = push(keyframe);
+        if (ok)
+            count++;
+    }
+
+    // Lets the display finish as soon as it's played the rest, rather than wait for more
+    keyframe.end = true;
+    push(keyframe);
+
+    if (ok) {
+        char response[64];
+        JsonWriter json(response, sizeof(response));
+        json.beginObject();
+        json.addString("message", "OK");
+        json.addInt("keyframes", count);
+        json.endObject();
+        httpd_resp_set_type(_request, "application/json");
+        httpd_resp_send(_request, json.getText(), json.getLength());
+    } else {
+        ESP_LOGW(TAG, "Stream ended after %d keyframes", count);
+        httpd_resp_send_err(_request, HTTPD_500_INTERNAL_SERVER_ERROR, "Animation stopped before the stream ended");
+    }
+
+    if (timeoutSet)
+        setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &serverTimeout, sizeof(serverTimeout));
+
+    httpd_req_async_handler_complete(_request);
+    _request = nullptr;
+    _busy = false;
+}
+
+bool AnimationStream::receive(uint8_t *data, size_t length) {
+    while (length > 0) {
+        int received = httpd_req_recv(_request, (char *)data, length);
+        if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+            if (!_displayManager.animating())
+                return false;
+            continue;
+        }
+        if (received <= 0)
+            return false;
+
+        data += received;
+        length -= received;
+        _remaining -= received;
+    }
+
+    return true;
+}
+
+bool AnimationStream::push(const Keyframe_t &keyframe) {
+    if (!_displayManager.animating())
+        return false;
+
+    // Nothing more is read from the body while this waits
+    while (xQueueSend(_keyframes, &keyframe, pdMS_TO_TICKS(waitMs)) != pdTRUE) {
+        if (!_displayManager.animating())
+            return false;
+    }
+
+    return true;
+}
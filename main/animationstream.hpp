@@ -0,0 +1,46 @@
+#pragma once
+
+#include "esp_http_server.h"
+#include "displaymanager.hpp"
+#include <atomic>
+#include <thread>
+
+// Feeds the display keyframes from the body of a request as it plays them, see keyframes.hpp
+// Keyframes go through a small queue, so animations of any length fit, and while the queue is full the body
+// isn't read, leaving TCP flow control to hold the sender back
+class AnimationStream {
+    public:
+        AnimationStream(DisplayManager &displayManager);
+        ~AnimationStream();
+
+        // Whether a stream is still being read
+        bool busy() { return _busy.load(); }
+
+        // Read and check the stream header, returns false if it isn't valid or the body isn't whole keyframes
+        bool readHeader(httpd_req_t *request);
+        // Have the display play from the queue, and take over the request to read the rest of it on a thread of its own
+        // Returns false if the display won't play it, the request is left to respond to
+        bool start(httpd_req_t *request);
+
+    private:
+        static const int queueLength = 8;
+        // How long to wait for room in the queue, or for more of the body, before checking the display is still playing
+        static const int waitMs = 500;
+
+        void reader();
+
+        // Read exactly length bytes of the body, returns false if the client went or the display stopped playing
+        bool receive(uint8_t *data, size_t length);
+        // Put a keyframe on the queue once there's room, returns false if the display stopped playing
+        bool push(const Keyframe_t &keyframe);
+
+        DisplayManager &_displayManager;
+        QueueHandle_t _keyframes = nullptr;
+
+        std::atomic_bool _busy = false;
+        std::thread _readerThread;
+        // The copy made by httpd_req_async_handler_begin, only used by the reader
+        httpd_req_t *_request = nullptr;
+        uint8_t _unitsCount = 0;
+        size_t _remaining = 0;
+};
@@ -0,0 +1,37 @@
+#include "boot.h"
+#include <atomic>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char* TAG = "BOOT";
+
+// Names for BootStage_t, in order
+static const char *stageNames[BOOT_STAGES_COUNT] = {"nvs", "homing", "calibration", "wifi", "webserver", "mdns", "time", "firstMessage"};
+
+// Recorded from several tasks, and read by the web server
+static std::atomic<int64_t> stageStartUs[BOOT_STAGES_COUNT];
+static std::atomic<int64_t> stageDoneUs[BOOT_STAGES_COUNT];
+
+void bootStageStart(BootStage_t stage) {
+    int64_t unset = 0;
+    stageStartUs[stage].compare_exchange_strong(unset, esp_timer_get_time());
+}
+
+void bootStageDone(BootStage_t stage) {
+    int64_t nowUs = esp_timer_get_time();
+    int64_t unset = 0;
+    if (!stageDoneUs[stage].compare_exchange_strong(unset, nowUs))
+        return;
+
+    ESP_LOGI(TAG, "%s done in %lld ms, %lld ms after boot", stageNames[stage],
+        (long long)((nowUs - stageStartUs[stage].load()) / 1000), (long long)(nowUs / 1000));
+}
+
+void getBootStage(BootStage_t stage, int64_t *startUs, int64_t *doneUs) {
+    *startUs = stageStartUs[stage].load();
+    *doneUs = stageDoneUs[stage].load();
+}
+
+const char *getBootStageName(BootStage_t stage) {
+    return stageNames[stage];
+}
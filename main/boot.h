@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Stages of start up, several of which run at the same time
+typedef enum {
+    BOOT_STAGE_NVS,
+    BOOT_STAGE_HOMING,
+    BOOT_STAGE_CALIBRATION,     // Loading saved calibration
+    BOOT_STAGE_WIFI,            // Connecting until there's an IP
+    BOOT_STAGE_WEBSERVER,
+    BOOT_STAGE_MDNS,
+    BOOT_STAGE_TIME,            // Until SNTP first sets the time
+    BOOT_STAGE_FIRST_MESSAGE,   // From the first message being taken off the queue to the units landing
+    BOOT_STAGES_COUNT
+} BootStage_t;
+
+// Record that a stage has started or finished, only the first of each is kept
+void bootStageStart(BootStage_t stage);
+void bootStageDone(BootStage_t stage);
+
+// Get when a stage started and finished, in microseconds since boot, 0 if it hasn't yet
+void getBootStage(BootStage_t stage, int64_t *startUs, int64_t *doneUs);
+
+const char *getBootStageName(BootStage_t stage);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,366 +1,487 @@
 #include "calibrate.hpp"
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include <memory.h>
 #include <stdio.h>
-#include <stdlib.h>
-#include <iostream>
+#include <stddef.h>
+#include <string.h>
+#include <memory>
 #include "esp_check.h"
+#include "esp_rom_crc.h"
 #include "esp_log.h"
-#include "esp_timer.h"
 #include "letters.hpp"
+#include "glyphs.hpp"
 
-// Get input from serial, save to buf up to max len
-static void getLineInput(char buf[], size_t len, unsigned long timeoutMillis = 86400000);
+static const char *TAG = "CALIBRATE";
 
-// Get numeric input from the user, using buf for the raw user input, up to len
-static int getNumberInput(char buf[], size_t len);
+// Fractional steps between flaps are stored in NVS as an integer number of these
+static const float pitchScale = 1000;
 
-// Get a yes/no answer from the user
-static bool getYesNoInput(char buf[], size_t len, bool defaultValue);
+// Bump whenever StoredCalibration_t changes, older blobs are then ignored
+static const uint16_t blobVersion = 1;
+static const char *blobKey = "units";
 
-// Get a yes/no answer from the user, but only give user a limited time to respond
-static bool getYesNoInputTimed(char buf[], size_t len, bool defaultValue, uint32_t waitMillis);
+// Slowest speed limit a unit can be given
+static const int maxStepInterval = 16;
 
-// Get the number of milliseconds since boot
-static unsigned long getMillis();
+// Widest edge margin a unit can be given, as for CONFIG_UNITS_EDGE_MARGIN_STEPS
+static const int maxEdgeMargin = 50;
 
-static const char *TAG = "CALIBRATE";
+// Rotations to average over when calibrating automatically
+static const int autoCalibrationRotations = 3;
 
-int UnitCalibration::getPositionForCharacter(char letter) {
-    // A-Z
-    if (letter >= 65 && letter <= 90) {
-        return getPosition(letter - 65 + unitLettersLettersStart);
+int UnitCalibration::getLetterNumForGlyph(uint8_t glyph, int fromLetterNum) {
+    // Failsafe
+    if (glyph >= unitLettersCount) {
+        ESP_LOGW(TAG, "Unsupported glyph %d", glyph);
+        return 0;
     }
 
-    // a-z
-    if (letter >= 97 && letter <= 122) {
-        return getPosition(letter - 97 + unitLettersLettersStart);
+    // Not every drum has every letter, e.g. digit only drums
+    const FlapSetLookup_t &lookup = flapSetLookups[_flapSet];
+    int letterNum = lookup.glyphLetters[glyph];
+    if (letterNum == noGlyph)
+        return lookup.blankLetter;
+
+    int lettersCount = getLettersCount();
+    if (fromLetterNum < 0 || fromLetterNum >= lettersCount)
+        return letterNum;
+
+    // Flap sets can repeat common letters, so take whichever copy is reached first going forward
+    int firstCopy = letterNum;
+    int flaps = (letterNum - fromLetterNum + lettersCount) % lettersCount;
+    for (int copy = lookup.nextCopies[firstCopy]; copy != firstCopy; copy = lookup.nextCopies[copy]) {
+        int copyFlaps = (copy - fromLetterNum + lettersCount) % lettersCount;
+        if (copyFlaps < flaps) {
+            letterNum = copy;
+            flaps = copyFlaps;
+        }
     }
 
-    // 0-9
-    if (letter >= 48 && letter <= 57) {
-        return getPosition(letter - 48 + unitLettersNumbersStart);
-    }
+    return letterNum;
+}
 
-    // Naive search
-    for (uint8_t i = 0; i < unitLettersCount; i++) {
-        if (letter == unitLetters[i])
-            return getPosition(i);
-    }
+int UnitCalibration::getStagePosition(int letterNum) {
+    int stagePosition = getDropPosition(letterNum + 1) - _edgeMargin;
 
-    // Failsafe
-    ESP_LOGW(TAG, "Unsupported letter %d", letter);
-    return getPosition(0);
+    // A margin wider than half a flap would mean moving backwards, which the drum can't do
+    int position = getPosition(letterNum);
+    return stagePosition > position ? stagePosition : position;
+}
+
+int UnitCalibration::getLetterNumForPosition(int position) {
+    if (_stepsBetweenFlaps <= 0)
+        return -1;
+
+    // From where it's calibrated to, until just before the next flap starts to drop
+    for (int letterNum = 0; letterNum < getLettersCount(); letterNum++) {
+        if (position >= getPosition(letterNum) && position <= getStagePosition(letterNum))
+            return letterNum;
+    }
+    return -1;
 }
 
 Calibrate::Calibrate(MultiStepper *units)
 : _units(units) {
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        _calibrations[i] = UnitCalibration(0, 0, CONFIG_UNITS_EDGE_MARGIN_STEPS, getUnitFlapSet(i));
+        _states[i] = CalibrationState::Uncalibrated;
+        _positions[i] = 0;
+    }
+}
+
+void Calibrate::load() {
     ESP_ERROR_CHECK(nvs_open("calibration", NVS_READWRITE, &_nvs));
+
+    std::lock_guard<std::mutex> lck(_lock);
+    memset(&_stored, 0, sizeof(_stored));
+    if (!readFromNvs() && migrateFromKeys())
+        ESP_LOGI(TAG, "Moved calibration saved by older firmware into a single blob");
+
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        _calibrations[i] = loadCalibration(i);
+        _states[i] = _calibrations[i].getStepsBetweenFlaps() > 0 ? CalibrationState::Calibrated : CalibrationState::Uncalibrated;
+    }
+
+    if (!allCalibrated())
+        ESP_LOGW(TAG, "Units need calibrating, see /api/calibration");
 }
 
-void Calibrate::populateCalibrations(UnitCalibration *unitCalibrations, int numUnits) {
-    for (int i = 0; i < numUnits; i++)
-        unitCalibrations[i] = readFromNvs(i);
+bool Calibrate::enqueue(CalibrationCommand_t command) {
+    return enqueue(&command, 1);
 }
 
-void Calibrate::calibrate() {
-    bool setupComplete = getNvsBool("complete", false);
-    if (setupComplete) {
-        std::cout << "Setup has already been completed. Would you like to rerun setup? [y/N]:\n";
-        std::cout << "If no response is provided in 5 seconds, the existing calibration will be used\n";
-        bool redoSetup = getYesNoInputTimed(_lineBuf, _lineBufLen, false, 5000);
-        if (!redoSetup) {
-            std::cout << "Continuing standard boot sequence";
-            return;
-        }
+bool Calibrate::enqueue(const CalibrationCommand_t *commands, size_t count) {
+    std::lock_guard<std::mutex> lck(_lock);
+    for (size_t i = 0; i < count; i++) {
+        if (!isValid(commands[i]))
+            return false;
     }
 
-    std::cout << "We're now going to calibrate each letter\n";
+    for (size_t i = 0; i < count; i++)
+        _commands.push_back(commands[i]);
+    return true;
+}
 
-    for (uint8_t i = 0; i < _units->getNumUnits(); i++)
-        calibrateUnit(i);
+bool Calibrate::isValid(const CalibrationCommand_t &command) {
+    bool allUnits = command.unitNum == -1 && command.action == CalibrationAction::Measure;
+    if (!allUnits && (command.unitNum < 0 || command.unitNum >= CONFIG_UNITS_COUNT))
+        return false;
 
-    setNvsBool("complete", true);
-    std::cout << "Calibration of all units complete!";
-}
+    // Drums only go forward
+    if (command.action == CalibrationAction::Jog && command.value <= 0)
+        return false;
 
-UnitCalibration Calibrate::calibrateUnit(uint8_t unitNum) {
-    std::cout << "We're calibrating unit: " << unitNum + 1 << '\n';
-
-    // Check if we've already got calibration data for this unit
-    UnitCalibration calibrationData = readFromNvs(unitNum);
-    if (calibrationData.getFirstLetterPosition() > 0) {
-        std::cout << "Existing calibration data found:\n";
-        std::cout << "First letter position: " << calibrationData.getFirstLetterPosition() << '\n';
-        std::cout << "Steps between flaps: " << calibrationData.getStepsBetweenFlaps() << '\n';
-
-        std::cout << "Would you like to use the existing calibration data? [Y/n]:\n";
-        bool useExisting = getYesNoInput(_lineBuf, _lineBufLen, true);
-        if (useExisting) {
-            std::cout << "Using existing calibration data for unit " << unitNum << "\n";
-            return calibrationData;
-        }
-    }
+    if ((command.action == CalibrationAction::ShowLetter || command.action == CalibrationAction::Confirm) &&
+        (command.value < 0 || command.value >= _calibrations[command.unitNum].getLettersCount()))
+        return false;
+
+    if (command.action == CalibrationAction::SetOffset && command.value < 0)
+        return false;
 
-    // Get initial ballpark values
-    calibrationData = initialHomeCalibration(unitNum);
+    // Letters are placed by the steps between flaps, which an unmeasured unit doesn't have yet
+    if ((command.action == CalibrationAction::Confirm || command.action == CalibrationAction::SetOffset) &&
+        command.stepsBetweenFlaps <= 0 && _calibrations[command.unitNum].getStepsBetweenFlaps() <= 0)
+        return false;
 
-    // Move 50% into the flap 'area' so that we have tolerance
-    calibrationData = UnitCalibration(
-        calibrationData.getFirstLetterPosition() + (calibrationData.getStepsBetweenFlaps() / 2), 
-        calibrationData.getStepsBetweenFlaps()
-    );
+    if (command.action == CalibrationAction::SetStepInterval && (command.value < 1 || command.value > maxStepInterval))
+        return false;
 
-    // Perform final calibration data
-    calibrationData = refineCalibration(unitNum, calibrationData);
+    if (command.action == CalibrationAction::SetEdgeMargin && (command.value < 0 || command.value > maxEdgeMargin))
+        return false;
 
-    // Let user know values, and save to long-term storage
-    std::cout << "First letter position: " << calibrationData.getFirstLetterPosition() << '\n';
-    std::cout << "Steps between flaps: " << calibrationData.getStepsBetweenFlaps() << '\n';
-    saveToNvs(unitNum, calibrationData);    
-    
-    return calibrationData;
+    return true;
 }
 
-UnitCalibration Calibrate::initialHomeCalibration(uint8_t unitNum) {
-    int targetPosition = 0;
-    std::cout << "You will be asked to answer yes or no whether a flap is visible.\n";
-    std::cout << "The default is NO if you press enter. Type in y to answer yes to any question.\n";
-    std::cout << "Don't worry if you overrun by 1 step, this won't impact calibration.\n";
-    std::cout << "There will also be coloured log output, you can ignore this except for debugging.\n";
+bool Calibrate::process() {
+    bool ran = false;
 
-    // Locate flap directly prior
     while (true) {
-        std::cout << "Is '!' showing? [y/N]\n";
-        bool response = getYesNoInput(_lineBuf, _lineBufLen, false);
-        if (response) {
-            break;
+        CalibrationCommand_t command;
+        {
+            std::lock_guard<std::mutex> lck(_lock);
+            if (_commands.empty())
+                break;
+            command = _commands.front();
+            _commands.pop_front();
         }
 
-        std::cout << "Moving 5 steps\n";
-        targetPosition += 5;
-        _units->setTargetPosition(unitNum, targetPosition);
-        _units->moveAllUnits();
+        run(command);
+        ran = true;
     }
 
-    std::cout << "Excellent! We now need to move to the very start of the next flap";
-    ++targetPosition;
+    std::lock_guard<std::mutex> lck(_lock);
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++)
+        _positions[i] = _units->getUnitPosition(i);
 
-    while (true) {
-        _units->setTargetPosition(unitNum, targetPosition);
-        _units->moveAllUnits();
+    return ran;
+}
 
-        std::cout << "Is a blank flap showing? [y/N]\n";
-        bool response = getYesNoInput(_lineBuf, _lineBufLen, false);
-        if (response) {
-            break;
-        }
+bool Calibrate::inProgress() {
+    std::lock_guard<std::mutex> lck(_lock);
+    if (!_commands.empty())
+        return true;
 
-        std::cout << "Moving 1 step\n";
-        ++targetPosition;
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        if (_states[i] == CalibrationState::Adjusting)
+            return true;
     }
+    return false;
+}
 
-    int spacePosition = targetPosition;
-    std::cout << "Excellent! We need to repeat the process one more time";
-    ++targetPosition;
+bool Calibrate::isComplete() {
+    std::lock_guard<std::mutex> lck(_lock);
+    return allCalibrated();
+}
 
-    while (true) {
-        _units->setTargetPosition(unitNum, targetPosition);
-        _units->moveAllUnits();
+bool Calibrate::allCalibrated() {
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        if (_states[i] != CalibrationState::Calibrated)
+            return false;
+    }
+    return true;
+}
+
+CalibrationStatus_t Calibrate::getStatus(uint8_t unitNum) {
+    std::lock_guard<std::mutex> lck(_lock);
+    return { _states[unitNum], _positions[unitNum], _calibrations[unitNum] };
+}
+
+void Calibrate::populateCalibrations(UnitCalibration *unitCalibrations, int numUnits) {
+    std::lock_guard<std::mutex> lck(_lock);
+    for (int i = 0; i < numUnits; i++)
+        unitCalibrations[i] = _calibrations[i];
+}
+
+void Calibrate::run(const CalibrationCommand_t &command) {
+    if (command.action == CalibrationAction::Measure) {
+        measure();
+        return;
+    }
+
+    uint8_t unitNum = command.unitNum;
+    UnitCalibration calibration;
+    {
+        std::lock_guard<std::mutex> lck(_lock);
+        calibration = _calibrations[unitNum];
+    }
 
-        std::cout << "Is 'A' showing? [y/N]\n";
-        bool response = getYesNoInput(_lineBuf, _lineBufLen, false);
-        if (response) {
+    switch (command.action) {
+        case CalibrationAction::Jog:
+            ESP_LOGI(TAG, "Unit %d jogging %d steps", unitNum + 1, command.value);
+            _units->setTargetPosition(unitNum, _units->getUnitPosition(unitNum) + command.value);
+            _units->moveAllUnits();
             break;
+
+        case CalibrationAction::ShowLetter:
+            _units->setTargetPosition(unitNum, calibration.getPosition(command.value));
+            _units->moveAllUnits();
+            break;
+
+        case CalibrationAction::Confirm: {
+            // Where the unit is now is the middle of the letter, so count back to the first letter
+            int firstLetterPosition = _units->getUnitPosition(unitNum) - (calibration.getPosition(command.value) - calibration.getFirstLetterPosition());
+            if (firstLetterPosition < 0) {
+                ESP_LOGW(TAG, "Unit %d can't be showing letter %d this close to home", unitNum + 1, command.value);
+                return;
+            }
+
+            ESP_LOGI(TAG, "Unit %d first letter confirmed at %d", unitNum + 1, firstLetterPosition);
+            setCalibration(unitNum, UnitCalibration(firstLetterPosition, calibration.getStepsBetweenFlaps(), calibration.getEdgeMargin(),
+                calibration.getFlapSet(), calibration.getRotationSteps(), calibration.getStepInterval()));
+            return;
         }
 
-        std::cout << "Moving 1 step\n";
-        ++targetPosition;
-    }
+        case CalibrationAction::SetOffset: {
+            float stepsBetweenFlaps = command.stepsBetweenFlaps > 0 ? command.stepsBetweenFlaps : calibration.getStepsBetweenFlaps();
+            setCalibration(unitNum, UnitCalibration(command.value, stepsBetweenFlaps, calibration.getEdgeMargin(),
+                calibration.getFlapSet(), calibration.getRotationSteps(), calibration.getStepInterval()));
+            return;
+        }
 
-    int nextFlapPosition = targetPosition;
-    int flapsDelta = nextFlapPosition - spacePosition;
+        case CalibrationAction::SetStepInterval:
+            setStepInterval(unitNum, command.value);
+            return;
+
+        case CalibrationAction::SetEdgeMargin:
+            setEdgeMargin(unitNum, command.value);
+            return;
+
+        default:
+            return;
+    }
 
-    return UnitCalibration(spacePosition, flapsDelta);
+    // Moved, so the unit isn't usable until confirmed or given an offset
+    std::lock_guard<std::mutex> lck(_lock);
+    _states[unitNum] = CalibrationState::Adjusting;
 }
 
-UnitCalibration Calibrate::refineCalibration(uint8_t unitNum, UnitCalibration calibrationData) {
-    for (int i = 0; i < calLettersCount; i++) {
-        // Move to letter
-        int targetNum = calLetters[i];
-        int position = calibrationData.getPosition(targetNum);
-        _units->setTargetPosition(unitNum, position);
-        _units->moveAllUnits();
-
-        // Confirm correct letter showing
-        std::cout << "\nIs '" << unitLetters[calLetters[i]] << "' showing? [y/N]\n";
-        bool letterShowing = getYesNoInput(_lineBuf, _lineBufLen, false);
-        if (letterShowing)
+void Calibrate::measure() {
+    float stepsPerRotation[CONFIG_UNITS_COUNT];
+
+    // Every unit is timed at once, the flap count then gives the pitch
+    _units->measureRotations(autoCalibrationRotations, stepsPerRotation);
+
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        UnitCalibration calibration;
+        {
+            std::lock_guard<std::mutex> lck(_lock);
+            calibration = _calibrations[i];
+        }
+
+        if (stepsPerRotation[i] <= 0) {
+            ESP_LOGE(TAG, "Unit %d never passed home, check its magnet and hall sensor", i + 1);
             continue;
+        }
 
-        // Get new values from user
-        std::cout << "\nFor the first unit, favour changing the steps between flaps\n";
-        std::cout << "For subsequent units, try the same steps as the first unit and adjust the offset\n";
-        std::cout << "The numbers in brackets are the *maximum* suggested change per try, lower changes often make sense.\n";
-        std::cout << "Current offset is: " << calibrationData.getFirstLetterPosition() << "\n";
-        std::cout << "Current steps between flaps is: " << calibrationData.getStepsBetweenFlaps() << "\n";
-        std::cout << "Enter a new value for offset (+- 5):\n";
-        int newOffset = getNumberInput(_lineBuf, _lineBufLen);
-        std::cout << "\nEnter a new value for the steps (+- 3):\n";
-        int newSteps = getNumberInput(_lineBuf, _lineBufLen);
-        calibrationData = UnitCalibration(newOffset, newSteps);
-        if (i > 0)
-            i -= 2;
-        else
-            --i;
+        // Keep the existing offset, otherwise assume the first flap drops at home
+        float stepsBetweenFlaps = stepsPerRotation[i] / calibration.getLettersCount();
+        int firstLetterPosition = calibration.getFirstLetterPosition();
+        if (firstLetterPosition <= 0)
+            firstLetterPosition = (int)(stepsBetweenFlaps / 2);
+
+        calibration = UnitCalibration(firstLetterPosition, stepsBetweenFlaps, calibration.getEdgeMargin(),
+            calibration.getFlapSet(), (int)(stepsPerRotation[i] + 0.5f), calibration.getStepInterval());
+        ESP_LOGI(TAG, "Unit %d: %.2f steps per rotation, %.3f steps between flaps", i + 1, stepsPerRotation[i], stepsBetweenFlaps);
+
+        std::lock_guard<std::mutex> lck(_lock);
+        _calibrations[i] = calibration;
+        _states[i] = CalibrationState::Adjusting;
     }
 
-    std::cout << "\nCalibration sequence complete!\n";
-    return calibrationData;
+    // Show every first letter at once, ready to confirm or correct
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++)
+        _units->setTargetPosition(i, getStatus(i).calibration.getPosition(0));
+    _units->moveAllUnits();
 }
 
-void Calibrate::saveToNvs(uint8_t unitNum, UnitCalibration calibration) {
-    char keyBuffer[NVS_KEY_NAME_MAX_SIZE];
-    sprintf(keyBuffer, "unit:%d:fl", unitNum);
-    setNvsInt(keyBuffer, calibration.getFirstLetterPosition());
-    sprintf(keyBuffer, "unit:%d:stp", unitNum);
-    setNvsInt(keyBuffer, calibration.getStepsBetweenFlaps());
+void Calibrate::setCalibration(uint8_t unitNum, UnitCalibration calibration) {
+    std::lock_guard<std::mutex> lck(_lock);
+    _calibrations[unitNum] = calibration;
+    _states[unitNum] = CalibrationState::Calibrated;
+    storeCalibration(unitNum, calibration);
+    saveToNvs();
 }
 
-UnitCalibration Calibrate::readFromNvs(uint8_t unitNum) {
-    char keyBuffer[NVS_KEY_NAME_MAX_SIZE];
-    sprintf(keyBuffer, "unit:%d:fl", unitNum);
-    int firstLetterPosition = getNvsInt(keyBuffer, 0);
-    sprintf(keyBuffer, "unit:%d:stp", unitNum);
-    int stepsBetweenFlaps = getNvsInt(keyBuffer, 0);
-
-    return UnitCalibration(firstLetterPosition, stepsBetweenFlaps);
+void Calibrate::setStepInterval(uint8_t unitNum, int stepInterval) {
+    std::lock_guard<std::mutex> lck(_lock);
+    UnitCalibration &calibration = _calibrations[unitNum];
+    calibration = UnitCalibration(calibration.getFirstLetterPosition(), calibration.getStepsBetweenFlaps(), calibration.getEdgeMargin(),
+        calibration.getFlapSet(), calibration.getRotationSteps(), stepInterval);
+    ESP_LOGI(TAG, "Unit %d steps every %d step delays", unitNum + 1, stepInterval);
+
+    // Only the speed changes, a unit that's still being adjusted keeps its last saved offset
+    StoredCalibration_t &stored = _stored.units[unitNum];
+    if (stored.flapSet != calibration.getFlapSet())
+        memset(&stored, 0, sizeof(stored));
+    stored.stepInterval = stepInterval;
+    stored.flapSet = calibration.getFlapSet();
+    saveToNvs();
 }
 
-bool Calibrate::getNvsBool(const char *key, bool defaultValue) {
-    uint8_t rawValue = 0;
-    esp_err_t err = nvs_get_u8(_nvs, key, &rawValue);
-
-    switch (err) {
-        case ESP_OK:
-            return rawValue > 0;
-        case ESP_ERR_NVS_NOT_FOUND:
-            return defaultValue;
-        default:
-            // Should throw error
-            ESP_ERROR_CHECK(err);
-            return defaultValue;
+void Calibrate::setEdgeMargin(uint8_t unitNum, int edgeMargin) {
+    std::lock_guard<std::mutex> lck(_lock);
+    UnitCalibration &calibration = _calibrations[unitNum];
+    calibration = UnitCalibration(calibration.getFirstLetterPosition(), calibration.getStepsBetweenFlaps(), edgeMargin,
+        calibration.getFlapSet(), calibration.getRotationSteps(), calibration.getStepInterval());
+    ESP_LOGI(TAG, "Unit %d stops %d steps short of the next flap", unitNum + 1, edgeMargin);
+
+    // Nothing moves, so like the speed it's kept whether or not the unit is calibrated
+    StoredCalibration_t &stored = _stored.units[unitNum];
+    if (stored.flapSet != calibration.getFlapSet()) {
+        memset(&stored, 0, sizeof(stored));
+        stored.stepInterval = calibration.getStepInterval();
     }
+    stored.edgeMargin = edgeMargin;
+    stored.flapSet = calibration.getFlapSet();
+    saveToNvs();
 }
 
-void Calibrate::setNvsBool(const char *key, bool value) {
-    uint8_t rawValue = value ? 1 : 0;
-    ESP_ERROR_CHECK(nvs_set_u8(_nvs, key, rawValue));
+void Calibrate::storeCalibration(uint8_t unitNum, UnitCalibration calibration) {
+    StoredCalibration_t &stored = _stored.units[unitNum];
+    stored.firstLetterPosition = calibration.getFirstLetterPosition();
+    stored.pitch = (int32_t)((calibration.getStepsBetweenFlaps() * pitchScale) + 0.5f);
+    stored.rotationSteps = calibration.getRotationSteps();
+    stored.edgeMargin = calibration.getEdgeMargin();
+    stored.stepInterval = calibration.getStepInterval();
+    stored.flapSet = calibration.getFlapSet();
 }
 
-int32_t Calibrate::getNvsInt(const char *key, int32_t defaultValue) {
-    int32_t rawValue = 0;
-    esp_err_t err = nvs_get_i32(_nvs, key, &rawValue);
+UnitCalibration Calibrate::loadCalibration(uint8_t unitNum) {
+    uint8_t flapSet = getUnitFlapSet(unitNum);
+    const StoredCalibration_t &stored = _stored.units[unitNum];
+    int stepInterval = stored.stepInterval >= 1 && stored.stepInterval <= maxStepInterval ? stored.stepInterval : 1;
 
-    switch (err) {
-        case ESP_OK:
-            return rawValue;
-        case ESP_ERR_NVS_NOT_FOUND:
-            return defaultValue;
-        default:
-            // Should throw error
-            ESP_ERROR_CHECK(err);
-            return defaultValue;
+    // A different drum needs calibrating again, a stored speed limit still applies to the motor
+    if (unitNum >= _stored.unitsCount || stored.flapSet != flapSet) {
+        if (unitNum < _stored.unitsCount && stored.pitch > 0)
+            ESP_LOGW(TAG, "Unit %d has a different flap set since it was calibrated", unitNum + 1);
+        return UnitCalibration(0, 0, CONFIG_UNITS_EDGE_MARGIN_STEPS, flapSet, 0, unitNum < _stored.unitsCount ? stepInterval : 1);
     }
+
+    return UnitCalibration(stored.firstLetterPosition, (float)stored.pitch / pitchScale, stored.edgeMargin, flapSet, stored.rotationSteps, stepInterval);
 }
 
-void Calibrate::setNvsInt(const char *key, int32_t value) {
-    ESP_ERROR_CHECK(nvs_set_i32(_nvs, key, value));
+void Calibrate::saveToNvs() {
+    _stored.version = blobVersion;
+    _stored.unitsCount = CONFIG_UNITS_COUNT;
+    _stored.crc = esp_rom_crc32_le(0, (const uint8_t*)&_stored.version, sizeof(_stored) - offsetof(CalibrationBlob_t, version));
+
+    // Everything in one write, so a reset part way through leaves either the old or the new calibration
+    esp_err_t err = nvs_set_blob(_nvs, blobKey, &_stored, sizeof(_stored));
+    if (err == ESP_OK)
+        err = nvs_commit(_nvs);
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Failed to save calibration: %s", esp_err_to_name(err));
 }
 
-static bool getYesNoInput(char buf[], size_t len, bool defaultValue) {
-    while (true) {
-        getLineInput(buf, len);
-        if (buf[0] == 'Y' || buf[0] == 'y')
-            return true;
-        if (buf[0] == 'N' || buf[0] == 'n')
-            return false;
-        if (buf[0] == 0 || buf[0] == '\n')
-            return defaultValue;
+bool Calibrate::readFromNvs() {
+    size_t length = 0;
+    esp_err_t err = nvs_get_blob(_nvs, blobKey, NULL, &length);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+        return false;
+
+    // May have been saved with a different number of units, so read whatever is there
+    std::unique_ptr<uint8_t[]> buffer;
+    if (err == ESP_OK && length >= offsetof(CalibrationBlob_t, units)) {
+        buffer.reset(new uint8_t[length]);
+        err = nvs_get_blob(_nvs, blobKey, buffer.get(), &length);
+    } else if (err == ESP_OK) {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    }
 
-        std::cout << "Invalid input, enter 'y' or 'n' as a single character:\n";
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read calibration: %s", esp_err_to_name(err));
+        return true;
     }
-}
 
-static bool getYesNoInputTimed(char buf[], size_t len, bool defaultValue, uint32_t waitMillis) {
-    while (true) {
-        getLineInput(buf, len, waitMillis);
-        if (buf[0] == 'Y' || buf[0] == 'y')
-            return true;
-        if (buf[0] == 'N' || buf[0] == 'n')
-            return false;
-        if (buf[0] == 0 || buf[0] == '\n')
-            return defaultValue;
+    CalibrationBlob_t *blob = (CalibrationBlob_t*)buffer.get();
+    size_t storedLength = offsetof(CalibrationBlob_t, units) + blob->unitsCount * sizeof(StoredCalibration_t);
+    if (blob->version != blobVersion || length != storedLength) {
+        ESP_LOGE(TAG, "Saved calibration is version %d, expected %d, units need calibrating", blob->version, blobVersion);
+        return true;
+    }
 
-        std::cout << "Invalid input, enter 'y' or 'n' as a single character:\n";
+    uint32_t crc = esp_rom_crc32_le(0, buffer.get() + offsetof(CalibrationBlob_t, version), length - offsetof(CalibrationBlob_t, version));
+    if (crc != blob->crc) {
+        ESP_LOGE(TAG, "Saved calibration is corrupt, units need calibrating");
+        return true;
     }
-}
 
-static int getNumberInput(char buf[], size_t len) {
-    getLineInput(buf, len);
-    return atoi(buf);
+    // Units beyond those saved stay uncalibrated, units that have since been removed are dropped
+    _stored.unitsCount = blob->unitsCount < CONFIG_UNITS_COUNT ? blob->unitsCount : CONFIG_UNITS_COUNT;
+    memcpy(_stored.units, blob->units, _stored.unitsCount * sizeof(StoredCalibration_t));
+    return true;
 }
 
-// https://stackoverflow.com/a/74227146
-static void getLineInput(char buf[], size_t len, unsigned long timeoutMillis)
-{
-    unsigned long startTime = getMillis();
-
-    memset(buf, 0, len);
-    fpurge(stdin); //clears any junk in stdin
-    char *bufp;
-    bufp = buf;
-    while(true) {
-        vTaskDelay(20/portTICK_PERIOD_MS);
-        *bufp = getchar();
-        if(*bufp != '\0' && *bufp != 0xFF && *bufp != '\r') //ignores null input, 0xFF, CR in CRLF
-        {
-            //'enter' (EOL) handler 
-            if (*bufp == '\n'){
-                *bufp = '\0';
-                std::cout << *bufp;
-                break;
-            } //backspace handler
-            else if (*bufp == '\b') {
-                if(bufp-buf >= 1)
-                    bufp--;
-                std::cout << '\n' << bufp;
-            }
-            else {
-                std::cout << *bufp;
-                //pointer to next character
-                bufp++;
-            }
-        }
-        
-        //only accept len-1 characters, (len) character being null terminator.
-        if (bufp-buf > (len)-2) {
-            bufp = buf + (len -1);
-            *bufp = '\0';
-            break;
-        }
-
-        // Check if timeout hit
-        unsigned long now = getMillis();
-        if (now - startTime > timeoutMillis) {
-            buf[0] = '\n';
-            buf[1] = 0;
-            return;
+bool Calibrate::migrateFromKeys() {
+    char keyBuffer[NVS_KEY_NAME_MAX_SIZE];
+    bool found = false;
+
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        sprintf(keyBuffer, "unit:%d:fl", i);
+        int firstLetterPosition = getNvsInt(keyBuffer, 0);
+        sprintf(keyBuffer, "unit:%d:stp", i);
+        float stepsBetweenFlaps = getNvsInt(keyBuffer, 0);
+        sprintf(keyBuffer, "unit:%d:pitch", i);
+        int32_t pitch = getNvsInt(keyBuffer, 0);
+        if (pitch > 0)
+            stepsBetweenFlaps = (float)pitch / pitchScale;
+        sprintf(keyBuffer, "unit:%d:em", i);
+        int edgeMargin = getNvsInt(keyBuffer, CONFIG_UNITS_EDGE_MARGIN_STEPS);
+
+        if (stepsBetweenFlaps > 0)
+            found = true;
+        storeCalibration(i, UnitCalibration(firstLetterPosition, stepsBetweenFlaps, edgeMargin, getUnitFlapSet(i)));
+    }
+    _stored.unitsCount = CONFIG_UNITS_COUNT;
+
+    // Saved either way, so a device that never had the old keys doesn't look for them again on every boot
+    // Saved before removing the old keys, so a reset part way through can't lose the calibration
+    saveToNvs();
+    if (!found)
+        return false;
+
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        for (const char *suffix : {"fl", "stp", "pitch", "em"}) {
+            sprintf(keyBuffer, "unit:%d:%s", i, suffix);
+            nvs_erase_key(_nvs, keyBuffer);
         }
     }
+    nvs_erase_key(_nvs, "complete");
+    ESP_ERROR_CHECK(nvs_commit(_nvs));
+    return true;
 }
 
-static unsigned long getMillis() {
-    return (unsigned long) (esp_timer_get_time() / 1000ULL);
-}
+int32_t Calibrate::getNvsInt(const char *key, int32_t defaultValue) {
+    int32_t rawValue = 0;
+    esp_err_t err = nvs_get_i32(_nvs, key, &rawValue);
+
+    switch (err) {
+        case ESP_OK:
+            return rawValue;
+        case ESP_ERR_NVS_NOT_FOUND:
+            return defaultValue;
+        default:
+            // Should throw error
+            ESP_ERROR_CHECK(err);
+            return defaultValue;
+    }
+}
\ No newline at end of file
@@ -1,49 +1,171 @@
 #pragma once
 
 #include "multistepper.hpp"
+#include "glyphs.hpp"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include <deque>
+#include <mutex>
 
 class UnitCalibration {
     public:
         UnitCalibration() {}
-        UnitCalibration(int firstLetterPosition, int stepsBetweenFlaps)
-        : _firstLetterPosition(firstLetterPosition), _stepsBetweenFlaps(stepsBetweenFlaps) {}
+        UnitCalibration(int firstLetterPosition, float stepsBetweenFlaps, int edgeMargin = CONFIG_UNITS_EDGE_MARGIN_STEPS, uint8_t flapSet = 0, int rotationSteps = 0, int stepInterval = 1)
+        : _firstLetterPosition(firstLetterPosition), _stepsBetweenFlaps(stepsBetweenFlaps), _edgeMargin(edgeMargin), _flapSet(flapSet), _rotationSteps(rotationSteps), _stepInterval(stepInterval) {}
 
         int getFirstLetterPosition() { return _firstLetterPosition; };
-        int getStepsBetweenFlaps() { return _stepsBetweenFlaps; };
-        int getPosition(int letterNum) { return _firstLetterPosition + (_stepsBetweenFlaps * letterNum); }
-        int getPositionForCharacter(char letter);
+        // Fractional, so rounding doesn't build up across the drum
+        float getStepsBetweenFlaps() { return _stepsBetweenFlaps; };
+        int getEdgeMargin() { return _edgeMargin; };
+        uint8_t getFlapSet() { return _flapSet; };
+        // Steps for a full rotation as measured when calibrating, 0 if never measured
+        int getRotationSteps() { return _rotationSteps; };
+        // Speed limit, the unit steps once every this many step delays
+        int getStepInterval() { return _stepInterval; };
+        int getLettersCount() { return flapSets[_flapSet].lettersCount; }
+        char32_t getLetter(int letterNum) { return flapSets[_flapSet].letters[letterNum]; }
+        uint8_t getGlyphForLetterNum(int letterNum) { return getGlyph(getLetter(letterNum)); }
+        int getPosition(int letterNum) { return _firstLetterPosition + (int)((_stepsBetweenFlaps * letterNum) + 0.5f); }
+
+        // Get the flap showing glyph, where a letter is on more than one flap this is the nearest copy
+        // going forward from fromLetterNum (-1 if unknown, which gives the first copy)
+        int getLetterNumForGlyph(uint8_t glyph, int fromLetterNum = -1);
+        int getPositionForGlyph(uint8_t glyph, int fromLetterNum = -1) { return getPosition(getLetterNumForGlyph(glyph, fromLetterNum)); }
+
+        // Position at which the flap for letterNum drops into view
+        // Letter positions are calibrated to the middle of each flap, so this is half a flap earlier
+        int getDropPosition(int letterNum) { return getPosition(letterNum) - (int)(_stepsBetweenFlaps / 2); }
+
+        // Furthest position the drum can advance to while letterNum is still the one showing
+        int getStagePosition(int letterNum);
+
+        // Letter settled on at a position, -1 part way between letters or if not calibrated
+        int getLetterNumForPosition(int position);
 
     private:
         int _firstLetterPosition = 0;
-        int _stepsBetweenFlaps = 0;
+        float _stepsBetweenFlaps = 0;
+        int _edgeMargin = CONFIG_UNITS_EDGE_MARGIN_STEPS;
+        uint8_t _flapSet = 0;
+        int _rotationSteps = 0;
+        int _stepInterval = 1;
+};
+
+enum class CalibrationState {
+    Uncalibrated,
+    Adjusting,
+    Calibrated
 };
 
+enum class CalibrationAction {
+    // Time the rotation of every unit, setting the steps between flaps, then show each unit's first letter
+    Measure,
+    // Move a unit forward by value steps
+    Jog,
+    // Move a unit to show letter value, to check its calibration
+    ShowLetter,
+    // The unit is showing letter value in the middle of the flap, so work out its offset from where it is
+    Confirm,
+    // Set a unit's offset to value, and its steps between flaps if stepsBetweenFlaps is more than 0
+    SetOffset,
+    // Limit a unit's speed to one step every value step delays, 1 for full speed
+    SetStepInterval,
+    // Stop value steps short of the next flap dropping when pre-staging or parking a unit
+    SetEdgeMargin
+};
+
+typedef struct {
+    CalibrationAction action;
+    int unitNum;    // -1 for every unit, only for Measure
+    int value;
+    float stepsBetweenFlaps;
+} CalibrationCommand_t;
+
+typedef struct {
+    CalibrationState state;
+    int position;
+    UnitCalibration calibration;
+} CalibrationStatus_t;
+
+// Calibration of a unit as saved in NVS
+typedef struct {
+    int32_t firstLetterPosition;
+    int32_t pitch;          // Steps between flaps in 1/1000ths, 0 if never calibrated
+    int32_t rotationSteps;
+    int16_t edgeMargin;
+    uint8_t stepInterval;
+    uint8_t flapSet;        // Saved calibrations are ignored if the unit's flap set has changed
+} StoredCalibration_t;
+
+// Every unit's calibration, saved as a single blob so loading is one read however many units there are
+typedef struct {
+    uint32_t crc;           // Of everything after it, up to the last stored unit
+    uint16_t version;
+    uint16_t unitsCount;
+    StoredCalibration_t units[CONFIG_UNITS_COUNT];
+} CalibrationBlob_t;
+
+// Calibration state machine, commands are queued from anywhere and run by the thread that moves the units
 class Calibrate {
     public:
         Calibrate(MultiStepper *units);
 
-        // Run the user through the calibration process
-        // Will auto-load where possible and prompt user with option to rerun
-        void calibrate();
+        // Load saved calibrations, NVS must be initialised first
+        void load();
+
+        // Queue a command to run on the next process(), returns false if the command is invalid
+        bool enqueue(CalibrationCommand_t command);
+        // Queue every command, or none of them if any is invalid
+        bool enqueue(const CalibrationCommand_t *commands, size_t count);
+
+        // Run all queued commands, returns true if any ran, in which case calibrations and unit positions may have changed
+        // Only call from the thread that moves the units
+        bool process();
+
+        // True while any unit is being adjusted, units shouldn't be used for messages until it's done
+        bool inProgress();
+
+        // True once every unit has been calibrated
+        bool isComplete();
+
+        CalibrationStatus_t getStatus(uint8_t unitNum);
 
         void populateCalibrations(UnitCalibration *unitCalibrations, int numUnits);
     
     private:
-        UnitCalibration calibrateUnit(uint8_t unitNum);
-        UnitCalibration initialHomeCalibration(uint8_t unitNum);
-        UnitCalibration refineCalibration(uint8_t unitNum, UnitCalibration calibrationData);
-
-        void saveToNvs(uint8_t unitNum, UnitCalibration calibration);
-        UnitCalibration readFromNvs(uint8_t unitNum);
-        bool getNvsBool(const char *key, bool defaultValue);
-        void setNvsBool(const char *key, bool value);
+        void run(const CalibrationCommand_t &command);
+        void measure();
+        void setCalibration(uint8_t unitNum, UnitCalibration calibration);
+        void setStepInterval(uint8_t unitNum, int stepInterval);
+        void setEdgeMargin(uint8_t unitNum, int edgeMargin);
+
+        // Must hold _lock
+        bool allCalibrated();
+        bool isValid(const CalibrationCommand_t &command);
+
+        // Write _stored to NVS and commit, must hold _lock
+        void saveToNvs();
+
+        // Read _stored from NVS, returns false if no blob has been saved yet
+        // A blob that can't be used is logged, and leaves every unit uncalibrated
+        bool readFromNvs();
+
+        // Convert calibrations saved by older firmware, one key per value, into _stored and save it
+        // The blob is saved even if there weren't any, returns false in that case
+        bool migrateFromKeys();
         int32_t getNvsInt(const char *key, int32_t defaultValue);
-        void setNvsInt(const char *key, int32_t value);
+
+        void storeCalibration(uint8_t unitNum, UnitCalibration calibration);
+        UnitCalibration loadCalibration(uint8_t unitNum);
 
         MultiStepper *_units;
-        char _lineBuf[1024];
-        size_t _lineBufLen = 1024;
-        nvs_handle_t _nvs;
+        nvs_handle_t _nvs = 0;
+        CalibrationBlob_t _stored;
+
+        // Guards the command queue and unit state, which are shared with other threads
+        std::mutex _lock;
+        std::deque<CalibrationCommand_t> _commands;
+        UnitCalibration _calibrations[CONFIG_UNITS_COUNT];
+        CalibrationState _states[CONFIG_UNITS_COUNT];
+        int _positions[CONFIG_UNITS_COUNT];
 };
\ No newline at end of file
@@ -7,10 +7,14 @@
 #include "esp_log.h"
 
 static const char* TAG = "CLOCK";
+// Clock updates supersede each other rather than stacking up in the display queue
+static const uint32_t clockCoalesceKey = 0xC10C;
 
 Clock::Clock(Display &display): _display(display) {
-    memset(_message.message, 0, sizeof(char)*10);
+    decodeGlyphs("", _message.glyphs, CONFIG_UNITS_COUNT);
     _message.minShowMs = 500;
+    _message.coalesceKey = clockCoalesceKey;
+    _message.showAtUs = 0;
 }
 
 void Clock::start() {
@@ -37,45 +41,49 @@ void Clock::stop() {
 
 void Clock::worker() {
     while (_active.load()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        // Wake on the second, so no 10s block is missed through drift
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        std::this_thread::sleep_for(std::chrono::microseconds(1000000 - tv.tv_usec));
 
         time_t now = 0;
         struct tm timeInfo;
         time(&now);
-        localtime_r(&now, &timeInfo);
 
         // Only update in 10s blocks
-        if (timeInfo.tm_sec % 10 != 0)
+        if (now % 10 != 0)
             continue;
 
+        // Queue up the next block now, so the flaps have time to move and land exactly on it
+        time_t showAt = now + 10;
+        localtime_r(&showAt, &timeInfo);
+
         if (timeInfo.tm_min % 5 == 0 && timeInfo.tm_sec == 0) {
-            showDate(timeInfo);
+            showDate(timeInfo, showAt);
         } else {
-            showTime(timeInfo);
+            showTime(timeInfo, showAt);
         }
     }
 }
 
-void Clock::showTime(struct tm timeInfo) {
+void Clock::showTime(struct tm timeInfo, time_t showAt) {
     char str[64] = {0};
 
     snprintf(str, 64, " %02d:%02d:%02d ", timeInfo.tm_hour, timeInfo.tm_min, timeInfo.tm_sec);
-    memcpy(_message.message, str, 10);
-    _display.clearQueue();
-    _display.enqueueMessage(_message);
+    decodeGlyphs(str, _message.glyphs, CONFIG_UNITS_COUNT);
+    _display.showAt(_message, (int64_t)showAt * 1000000LL);
 }
 
-void Clock::showDate(struct tm timeInfo) {
+void Clock::showDate(struct tm timeInfo, time_t showAt) {
     char str[64] = {0};
     int month = timeInfo.tm_mon + 1;
     int year = timeInfo.tm_year + 1900;
 
     snprintf(str, 64, "%02d-%02d-%04d", timeInfo.tm_mday, month, year);
-    memcpy(_message.message, str, 10);
-    _display.clearQueue();
-    _display.enqueueMessage(_message);
+    decodeGlyphs(str, _message.glyphs, CONFIG_UNITS_COUNT);
+    _display.showAt(_message, (int64_t)showAt * 1000000LL);
 
     // We don't want to block other messages, but we also don't want to show the time for a little bit
     // So just delay the clock thread for a bit
     std::this_thread::sleep_for(std::chrono::seconds(20));
-}
+}
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "Display.hpp"
 #include <thread>
 #include <atomic>
+#include <time.h>
 
 class Clock {
     public:
@@ -13,11 +14,12 @@ class Clock {
 
     private:
         void worker();
-        void showTime(struct tm timeInfo);
-        void showDate(struct tm timeInfo);
+        // Show the time / date from timeInfo, landing at showAt
+        void showTime(struct tm timeInfo, time_t showAt);
+        void showDate(struct tm timeInfo, time_t showAt);
 
         Display &_display;
         std::atomic_bool _active = false;
         std::thread _workerThread;
-        DisplayMessage_t _message;
+        DisplayMessage_t _message = {};
 };
\ No newline at end of file
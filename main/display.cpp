@@ -1,17 +1,34 @@
 #include "display.hpp"
 #include "calibrate.hpp"
 #include "esp_log.h"
+#include "boot.h"
+#include "keyframes.hpp"
 #include <chrono>
 #include <esp_pthread.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include <sys/time.h>
 
 static const char* TAG = "DISPLAY";
 static const long long workerWaitMs = 100;
-static const size_t maxQueueLength = 10;
+// An animation whose stream stalls this long is ended, leaving the units where they are
+static const int animationStallMs = 5000;
+
+// Get the wall clock time in microseconds since the epoch
+static int64_t getTimeUs();
 
 Display::Display(MultiStepper &multiStepper):
-    _multiStepper(multiStepper) {
+    _multiStepper(multiStepper), _calibrate(&multiStepper), _estimator(_unitCalibrations, multiStepper.getStepDelayUs()) {
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        _currentLetters[i] = -1;
+        _restPositions[i] = 0;
+        _rotationSteps[i] = 0;
+        _unitMoving[i] = false;
+    }
+
+    memset(&_state, 0, sizeof(_state));
+    _state.mode = DisplayMode::Text;
+    memset(_state.unitGlyphs, noGlyph, sizeof(_state.unitGlyphs));
 }
 
 Display::~Display() {
@@ -40,34 +57,225 @@ void Display::stop() {
     if (!_active.load())
         return;
 
-    while (_messageQueue.size() > 0)
-        _messageQueue.pop();
+    _messageQueue.clear();
+    publishQueueLength();
 
     _active = false;
     _ready = false;
 }
 
-bool Display::enqueueMessage(DisplayMessage_t message) {
+bool Display::enqueueMessage(DisplayMessage_t message, MessageEta_t *eta, uint32_t *messageId) {
     std::lock_guard<std::mutex> lck(_messageQueueLock);
-    if (_messageQueue.size() > maxQueueLength) {
-        ESP_LOGW(TAG, "Max queue size reached, message rejected");
-        return false;
+
+    // Superseded updates are replaced in place, so only the latest value is ever shown
+    bool replaces;
+    size_t position = findQueuePosition(message, replaces);
+    if (replaces) {
+        message.id = _messageQueue[position].id;
+        _messageQueue[position] = message;
+    } else {
+        if (_messageQueue.size() >= maxQueueLength) {
+            ESP_LOGW(TAG, "Max queue size reached, message rejected");
+            return false;
+        }
+        message.id = nextMessageId();
+        _messageQueue.insert(_messageQueue.begin() + position, message);
+    }
+
+    // Sent for replacements too, the length is unchanged but the queue's contents aren't, and the
+    // event bumps the state version that /api/queue and /api/status are cached against
+    publishQueueLength();
+
+    if (messageId != nullptr)
+        *messageId = message.id;
+
+    if (eta != nullptr) {
+        resetEstimator();
+        for (size_t i = 0; i <= position; i++)
+            *eta = _estimator.project(_messageQueue[i]);
     }
-    _messageQueue.push(message);
 
     return true;
 }
 
+bool Display::getShowAtUs(double showAtMs, int64_t &showAtUs) {
+    // Checked in milliseconds first, so it can't overflow converting
+    if (!(showAtMs >= 0 && showAtMs <= (double)(getTimeUs() + maxShowAtAheadUs) / 1000))
+        return false;
+
+    showAtUs = (int64_t)showAtMs * 1000;
+    return true;
+}
+
+bool Display::showAt(DisplayMessage_t message, int64_t showAtUs) {
+    message.showAtUs = showAtUs;
+    return enqueueMessage(message);
+}
+
 void Display::clearQueue() {
     std::lock_guard<std::mutex> lck(_messageQueueLock);
-    while (_messageQueue.size() > 0)
-        _messageQueue.pop();
+    _messageQueue.clear();
+    publishQueueLength();
+}
+
+bool Display::enqueueMessages(const DisplayMessage_t *messages, size_t count, MessageEta_t *etas) {
+    if (count == 0)
+        return true;
+    if (count > maxQueueLength)
+        return false;
+
+    std::lock_guard<std::mutex> lck(_messageQueueLock);
+
+    // Work out the room needed first, messages replacing queued ones or each other don't need any
+    size_t added = 0;
+    for (size_t i = 0; i < count; i++) {
+        bool replaces;
+        findQueuePosition(messages[i], replaces);
+        for (size_t j = 0; j < i && !replaces; j++)
+            replaces = messages[i].coalesceKey != 0 && messages[j].coalesceKey == messages[i].coalesceKey;
+        if (!replaces)
+            added++;
+    }
+
+    if (_messageQueue.size() + added > maxQueueLength) {
+        ESP_LOGW(TAG, "Max queue size reached, %d messages rejected", (int)count);
+        return false;
+    }
+
+    size_t positions[maxQueueLength];
+    for (size_t i = 0; i < count; i++) {
+        bool replaces;
+        size_t position = findQueuePosition(messages[i], replaces);
+        if (replaces) {
+            uint32_t id = _messageQueue[position].id;
+            _messageQueue[position] = messages[i];
+            _messageQueue[position].id = id;
+        } else {
+            // Anything already placed behind it moves back one
+            _messageQueue.insert(_messageQueue.begin() + position, messages[i]);
+            _messageQueue[position].id = nextMessageId();
+            for (size_t j = 0; j < i; j++) {
+                if (positions[j] >= position)
+                    positions[j]++;
+            }
+        }
+        positions[i] = position;
+    }
+
+    size_t lastPosition = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (positions[i] > lastPosition)
+            lastPosition = positions[i];
+    }
+
+    // Even if every message replaced one already queued, as in enqueueMessage
+    publishQueueLength();
+
+    if (etas != nullptr) {
+        // One pass over the queue gives every message's timings
+        resetEstimator();
+        for (size_t position = 0; position <= lastPosition; position++) {
+            DisplayMessage_t &queued = _messageQueue[position];
+            MessageEta_t eta = _estimator.project(queued);
+            for (size_t i = 0; i < count; i++) {
+                if (positions[i] == position)
+                    etas[i] = eta;
+            }
+        }
+    }
+
+    return true;
+}
+
+uint32_t Display::nextMessageId() {
+    if (++_lastMessageId == 0)
+        _lastMessageId = 1;
+    return _lastMessageId;
+}
+
+size_t Display::findQueuePosition(const DisplayMessage_t &message, bool &replaces) {
+    replaces = false;
+    if (message.coalesceKey != 0) {
+        for (size_t i = 0; i < _messageQueue.size(); i++) {
+            if (_messageQueue[i].coalesceKey == message.coalesceKey) {
+                replaces = true;
+                return i;
+            }
+        }
+    }
+
+    size_t position = _messageQueue.size();
+    while (position > 0 && _messageQueue[position - 1].priority < message.priority)
+        position--;
+    return position;
+}
+
+int64_t Display::getRoomWaitUs(size_t count) {
+    std::lock_guard<std::mutex> lck(_messageQueueLock);
+
+    if (count > maxQueueLength)
+        return -1;
+    if (_messageQueue.size() + count <= maxQueueLength)
+        return 0;
+
+    // The worker takes the first queued message once the one showing is released, and each one after
+    // once the one before it is released
+    size_t needed = _messageQueue.size() + count - maxQueueLength;
+    int64_t roomAtUs = resetEstimator();
+    for (size_t i = 0; i + 1 < needed; i++) {
+        DisplayMessage_t &queued = _messageQueue[i];
+        roomAtUs = _estimator.project(queued).releaseUs;
+    }
+
+    int64_t nowUs = getTimeUs();
+    return roomAtUs > nowUs ? roomAtUs - nowUs : 0;
+}
+
+size_t Display::getQueueTimeline(QueuedMessage_t *timeline) {
+    std::lock_guard<std::mutex> lck(_messageQueueLock);
+
+    // Filled in place rather than returned, so polling the queue doesn't allocate
+    resetEstimator();
+    size_t count = 0;
+    for (auto &message : _messageQueue) {
+        if (count >= maxQueueLength)
+            break;
+        timeline[count].message = message;
+        timeline[count].eta = _estimator.project(message);
+        count++;
+    }
+
+    return count;
+}
+
+void Display::getLetterTransitions(uint16_t *transitions) {
+    std::lock_guard<std::mutex> lck(_messageQueueLock);
+    for (int from = 0; from < unitLettersCount; from++) {
+        for (int to = 0; to < unitLettersCount; to++)
+            transitions[(from * unitLettersCount) + to] = _letterStats.getTransitions(from, to);
+    }
+}
+
+bool Display::calibrate(CalibrationCommand_t command) {
+    return _calibrate.enqueue(command);
+}
+
+bool Display::calibrate(const CalibrationCommand_t *commands, size_t count) {
+    return _calibrate.enqueue(commands, count);
+}
+
+CalibrationStatus_t Display::getCalibrationStatus(uint8_t unitNum) {
+    return _calibrate.getStatus(unitNum);
+}
+
+bool Display::calibrationComplete() {
+    return _calibrate.isComplete();
 }
 
 void Display::worker() {
     // Need to make sure the units are all homed and happy
+    // Anything queued meanwhile is kept, and shown as soon as they are
     initUnits();
-    clearQueue();
     _ready = true;
 
     // Process messages as they come
@@ -75,40 +283,579 @@ void Display::worker() {
         // Always a little delay so we don't consume all the resources busy waiting
         std::this_thread::sleep_for(std::chrono::milliseconds(workerWaitMs));
 
+        // Messages wait until any units being calibrated are done
+        if (processCalibration())
+            continue;
+
+        // Queued messages wait for an animation to finish
+        QueueHandle_t keyframes = _animationKeyframes.load();
+        if (keyframes != nullptr) {
+            animate(keyframes);
+            _animationKeyframes = nullptr;
+            continue;
+        }
+
         // Get next message
         DisplayMessage_t message;
+        bool idle = false;
         {
             std::lock_guard<std::mutex> lck(_messageQueueLock);
-            if (_messageQueue.empty()) {
+            idle = _messageQueue.empty();
+        }
+
+        if (idle) {
+#ifdef CONFIG_UNITS_IDLE_PARK
+            parkWhenIdle();
+#endif
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lck(_messageQueueLock);
+            if (_messageQueue.empty() || !isDue(_messageQueue.front())) {
                 continue;
             }
             message = _messageQueue.front();
-            _messageQueue.pop();
+            _messageQueue.pop_front();
+
+            // Keep track of when we'll be free, so queued messages can be estimated while this one is shown
+            _estimator.reset(_restPositions, _currentLetters, _rotationSteps, getTimeUs());
+            _readyAtUs = _estimator.project(message).releaseUs;
+
+            planMove(message);
+            publishQueueLength();
         }
 
-        // Display the message
-        ESP_LOGI(TAG, "Displaying message");
+        _movingMessage = message;
+        DisplayEvent_t event = {};
+        event.message = &_movingMessage;
         for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
-            int position = _unitCalibrations[i].getPositionForCharacter(message.message[i]);
-            _multiStepper.setTargetPosition(i, position);
+            int steps = _multiStepper.getStepsToTarget(i);
+            _unitMoving[i] = steps > 0;
+            if (_unitMoving[i]) {
+                event.changedUnits++;
+                event.steps += steps;
+            }
+        }
+
+        event.type = DisplayEventType::Message;
+        publishEvent(event);
+
+        // Display the message
+        ESP_LOGI(TAG, "Displaying message, %d units changing", event.changedUnits);
+        bootStageStart(BOOT_STAGE_FIRST_MESSAGE);
+        // Already showing, so the units, timer and shift chain are left alone and only the hold starts again
+        if (event.changedUnits > 0 && message.showAtUs > 0)
+            scheduleArrival(message.showAtUs);
+        event.type = DisplayEventType::MotionStarted;
+        publishEvent(event);
+        if (event.changedUnits > 0)
+            _multiStepper.moveAllUnits(unitArrivedC, this);
+        event.type = DisplayEventType::MotionDone;
+        publishEvent(event);
+        bootStageDone(BOOT_STAGE_FIRST_MESSAGE);
+
+        {
+            std::lock_guard<std::mutex> lck(_messageQueueLock);
+            _readyAtUs = getTimeUs() + (message.minShowMs > 0 ? message.minShowMs * 1000 : 0);
+            if (event.changedUnits > 0)
+                updateRotationSteps();
         }
-        _multiStepper.moveAllUnits();
         
-        // Sleep for the minimum display duration
+        // Hold for the minimum display duration
         ESP_LOGI(TAG, "Message displayed");
-        long long delayMs = message.minShowMs - workerWaitMs;
-        if (delayMs > 0)
-            std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+        holdMessage(message.minShowMs - workerWaitMs);
     }
 }
 
+bool Display::playAnimation(QueueHandle_t keyframes) {
+    QueueHandle_t none = nullptr;
+    return _active.load() && _animationKeyframes.compare_exchange_strong(none, keyframes);
+}
+
+void Display::animate(QueueHandle_t keyframes) {
+    ESP_LOGI(TAG, "Playing animation");
+#ifdef CONFIG_UNITS_IDLE_PARK
+    _parked = false;
+#endif
+
+    DisplayEvent_t event = {};
+    event.type = DisplayEventType::AnimationStarted;
+    publishEvent(event);
+
+    Keyframe_t keyframe;
+    int played = 0;
+    while (_active.load() && xQueueReceive(keyframes, &keyframe, pdMS_TO_TICKS(animationStallMs)) == pdTRUE && !keyframe.end) {
+        int travelSteps = 0;
+        for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+            if (keyframe.targets[i] == keyframeKeep)
+                continue;
+
+            // A position past a full rotation would never be reached
+            int target = keyframe.targets[i];
+            if (_rotationSteps[i] > 0)
+                target %= _rotationSteps[i];
+            // Never faster than the unit's calibrated speed, it may skip steps and lose its position above that
+            int stepInterval = keyframe.stepIntervals[i];
+            if (stepInterval < _unitCalibrations[i].getStepInterval())
+                stepInterval = _unitCalibrations[i].getStepInterval();
+            _multiStepper.setStepInterval(i, stepInterval);
+            _multiStepper.setTargetPosition(i, target);
+
+            int steps = MotionEstimator::stepsBetween(_multiStepper.getUnitPosition(i), target, _rotationSteps[i]) * stepInterval;
+            if (steps > travelSteps)
+                travelSteps = steps;
+        }
+
+        // Messages queued while it plays get ETAs from after this keyframe and its hold, not from when it started
+        {
+            std::lock_guard<std::mutex> lck(_messageQueueLock);
+            int64_t busyUntilUs = getTimeUs() + _estimator.stepsToUs(travelSteps) + (keyframe.holdMs * 1000LL);
+            if (busyUntilUs > _readyAtUs)
+                _readyAtUs = busyUntilUs;
+        }
+        _multiStepper.moveAllUnits();
+
+        // Units can land anywhere, so what they show is worked out from where they are
+        {
+            std::lock_guard<std::mutex> lck(_messageQueueLock);
+            for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+                _restPositions[i] = _multiStepper.getUnitPosition(i);
+                _currentLetters[i] = _unitCalibrations[i].getLetterNumForPosition(_restPositions[i]);
+            }
+        }
+        updateState(nullptr);
+
+        // In short sleeps, so stopping the display doesn't wait out a long hold
+        auto holdEnd = std::chrono::steady_clock::now() + std::chrono::milliseconds(keyframe.holdMs);
+        while (_active.load() && std::chrono::steady_clock::now() < holdEnd) {
+            auto wakeAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(workerWaitMs);
+            std::this_thread::sleep_until(wakeAt < holdEnd ? wakeAt : holdEnd);
+        }
+        played++;
+    }
+
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++)
+        _multiStepper.setStepInterval(i, _unitCalibrations[i].getStepInterval());
+
+    {
+        std::lock_guard<std::mutex> lck(_messageQueueLock);
+        _readyAtUs = getTimeUs();
+    }
+
+    event.type = DisplayEventType::AnimationDone;
+    publishEvent(event);
+    ESP_LOGI(TAG, "Animation done, %d keyframes", played);
+}
+
+bool Display::addEventListener(DisplayEventFn fn, void *context) {
+    std::lock_guard<std::mutex> lck(_eventListenersLock);
+
+    int count = _eventListenersCount.load();
+    if (count >= maxEventListeners)
+        return false;
+
+    _eventListeners[count] = fn;
+    _eventContexts[count] = context;
+    _eventListenersCount = count + 1;
+    return true;
+}
+
+void Display::publishEvent(const DisplayEvent_t &event) {
+    updateState(&event);
+
+    int count = _eventListenersCount.load();
+    for (int i = 0; i < count; i++)
+        _eventListeners[i](_eventContexts[i], event);
+}
+
+void Display::publishQueueLength() {
+    DisplayEvent_t event = {};
+    event.type = DisplayEventType::Queue;
+    event.queueLength = _messageQueue.size();
+    publishEvent(event);
+}
+
+void Display::getState(DisplayState_t &state) {
+    while (true) {
+        uint32_t sequence = _stateSequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        memcpy(&state, &_state, sizeof(state));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_stateSequence.load(std::memory_order_relaxed) == sequence) {
+            state.version = sequence / 2;
+            return;
+        }
+    }
+}
+
+void Display::updateState(const DisplayEvent_t *event) {
+    // Writers take turns, readers never take the lock
+    std::lock_guard<std::mutex> lck(_stateLock);
+    uint32_t sequence = _stateSequence.load(std::memory_order_relaxed);
+    _stateSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (event == nullptr) {
+        for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++)
+            updateUnitState(i);
+    } else {
+        switch (event->type) {
+            case DisplayEventType::Mode:
+                _state.mode = event->mode;
+                break;
+            case DisplayEventType::Queue:
+                _state.queueLength = event->queueLength;
+                break;
+            case DisplayEventType::Message:
+                memcpy(_state.message, event->message->glyphs, sizeof(_state.message));
+                _state.hasMessage = true;
+                _state.changedUnits = event->changedUnits;
+                _state.steps = event->steps;
+                _state.messagesShown++;
+                if (event->changedUnits == 0)
+                    _state.messagesUnchanged++;
+                _state.totalSteps += event->steps;
+                break;
+            case DisplayEventType::MotionStarted:
+                _state.moving = true;
+                break;
+            case DisplayEventType::UnitArrived:
+                updateUnitState(event->unitNum);
+                break;
+            case DisplayEventType::MotionDone:
+            case DisplayEventType::AnimationDone:
+                _state.moving = false;
+                for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++)
+                    updateUnitState(i);
+                break;
+            case DisplayEventType::AnimationStarted:
+                // No longer showing a message, just whatever the units land on
+                _state.hasMessage = false;
+                _state.moving = true;
+                break;
+        }
+    }
+
+    _stateSequence.store(sequence + 2, std::memory_order_release);
+}
+
+void Display::updateUnitState(uint8_t unitNum) {
+    int letterNum = _currentLetters[unitNum];
+    _state.unitGlyphs[unitNum] = letterNum < 0 ? noGlyph : _unitCalibrations[unitNum].getGlyphForLetterNum(letterNum);
+    _state.unitPositions[unitNum] = _multiStepper.getUnitPosition(unitNum);
+}
+
+void Display::unitArrived(uint8_t unitNum) {
+    // Units already showing their letter arrive straight away, and aren't news
+    if (!_unitMoving[unitNum])
+        return;
+
+    DisplayEvent_t event = {};
+    event.type = DisplayEventType::UnitArrived;
+    event.message = &_movingMessage;
+    event.unitNum = unitNum;
+    publishEvent(event);
+}
+
+bool Display::processCalibration() {
+    if (_calibrate.process()) {
+        UnitCalibration calibrations[CONFIG_UNITS_COUNT];
+        _calibrate.populateCalibrations(calibrations, CONFIG_UNITS_COUNT);
+
+        // Units that moved or changed calibration can't be trusted to show what they did
+        std::lock_guard<std::mutex> lck(_messageQueueLock);
+        for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+            UnitCalibration &calibration = _unitCalibrations[i];
+            bool changed = calibration.getFirstLetterPosition() != calibrations[i].getFirstLetterPosition() ||
+                calibration.getStepsBetweenFlaps() != calibrations[i].getStepsBetweenFlaps();
+            int position = _multiStepper.getUnitPosition(i);
+            if (changed || position != _restPositions[i]) {
+                _currentLetters[i] = -1;
+                _restPositions[i] = position;
+            }
+
+            _unitCalibrations[i] = calibrations[i];
+            _multiStepper.setStepInterval(i, calibrations[i].getStepInterval());
+        }
+        updateRotationSteps();
+        updateState(nullptr);
+    }
+
+    return _calibrate.inProgress();
+}
+
+int64_t Display::resetEstimator() {
+    int64_t readyUs = getTimeUs() + workerWaitMs * 1000;
+    if (_readyAtUs > readyUs)
+        readyUs = _readyAtUs;
+
+    _estimator.reset(_restPositions, _currentLetters, _rotationSteps, readyUs);
+    return readyUs;
+}
+
+void Display::planMove(const DisplayMessage_t &message) {
+#ifdef CONFIG_UNITS_IDLE_PARK
+    _parked = false;
+#endif
+
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        int letterNum = getMessageLetterNum(_unitCalibrations[i], message, i, _currentLetters[i]);
+        _letterStats.record(i, letterNum);
+        if (_unitCalibrations[i].getFlapSet() == 0)
+            _letterStats.recordTransition(_currentLetters[i], letterNum);
+
+        // Already showing, and may have been pre-staged further into the flap, so leave it be
+        if (letterNum == _currentLetters[i])
+            continue;
+
+        int position = _unitCalibrations[i].getPosition(letterNum);
+        _multiStepper.setTargetPosition(i, position);
+        _currentLetters[i] = letterNum;
+        _restPositions[i] = position;
+    }
+}
+
+void Display::updateRotationSteps() {
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        int rotationSteps = _multiStepper.getFullRotationSteps(i);
+        if (rotationSteps <= 0)
+            rotationSteps = _unitCalibrations[i].getRotationSteps();
+        if (rotationSteps <= 0) {
+            UnitCalibration &calibration = _unitCalibrations[i];
+            rotationSteps = calibration.getDropPosition(0) + (int)(calibration.getLettersCount() * calibration.getStepsBetweenFlaps());
+        }
+
+        _rotationSteps[i] = rotationSteps;
+    }
+}
+
+bool Display::isDue(const DisplayMessage_t &message) {
+    if (message.showAtUs <= 0)
+        return true;
+
+    // Taken once the units would need to start within the next couple of loops, anything queued ahead of it
+    // meanwhile still goes first
+    int64_t nowUs = getTimeUs();
+    _estimator.reset(_restPositions, _currentLetters, _rotationSteps, nowUs);
+    MessageEta_t eta = _estimator.project(message);
+    return eta.startUs - nowUs <= workerWaitMs * 2 * 1000;
+}
+
+void Display::scheduleArrival(int64_t showAtUs) {
+    // Units all step together, so units with less distance to cover hold back and the slowest move sets the start
+    int steps[CONFIG_UNITS_COUNT];
+    int maxSteps = 0;
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        steps[i] = _multiStepper.getStepsToTarget(i) * _unitCalibrations[i].getStepInterval();
+        if (steps[i] > maxSteps)
+            maxSteps = steps[i];
+    }
+
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        if (steps[i] > 0)
+            _multiStepper.setStartDelay(i, maxSteps - steps[i]);
+    }
+
+    int64_t startUs = showAtUs - (int64_t)(maxSteps * _multiStepper.getStepDelayUs());
+    int64_t waitUs = startUs - getTimeUs();
+    if (waitUs < -(int64_t)_multiStepper.getStepDelayUs())
+        ESP_LOGW(TAG, "Message scheduled too late, will arrive %lld ms late", (long long)(-waitUs / 1000));
+
+    // Only taken off the queue once it's nearly due, so this is short, but stop() still shouldn't wait on it
+    while (waitUs > 0 && _active.load()) {
+        std::this_thread::sleep_for(std::chrono::microseconds(waitUs < workerWaitMs * 1000 ? waitUs : workerWaitMs * 1000));
+        waitUs = startUs - getTimeUs();
+    }
+}
+
+void Display::holdMessage(long long holdMs) {
+    if (holdMs <= 0)
+        return;
+
+    auto holdEnd = std::chrono::steady_clock::now() + std::chrono::milliseconds(holdMs);
+
+#ifdef CONFIG_UNITS_PRESTAGE
+    // Use the hold to get the units ready for the next message, as soon as there is one
+    while (std::chrono::steady_clock::now() < holdEnd) {
+        DisplayMessage_t next;
+        bool hasNext = false;
+        {
+            std::lock_guard<std::mutex> lck(_messageQueueLock);
+            if (!_messageQueue.empty()) {
+                next = _messageQueue.front();
+                hasNext = true;
+            }
+        }
+
+        if (hasNext) {
+            prestage(next);
+            break;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(workerWaitMs));
+    }
+#endif
+
+    std::this_thread::sleep_until(holdEnd);
+}
+
+void Display::prestage(const DisplayMessage_t &next) {
+    bool staged = false;
+
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        // Position unknown, e.g. just after homing
+        int currentLetter = _currentLetters[i];
+        if (currentLetter < 0)
+            continue;
+
+        // Unit won't change for the next message, nothing to gain
+        int nextLetter = getMessageLetterNum(_unitCalibrations[i], next, i, currentLetter);
+        if (nextLetter == currentLetter)
+            continue;
+
+        // Advance to just short of the next flap dropping, so what's showing doesn't change
+        int stagePosition = _unitCalibrations[i].getStagePosition(currentLetter);
+        if (_multiStepper.getUnitPosition(i) >= stagePosition)
+            continue;
+
+        _multiStepper.setTargetPosition(i, stagePosition);
+        staged = true;
+    }
+
+    if (!staged)
+        return;
+
+    ESP_LOGI(TAG, "Pre-staging next message");
+    _multiStepper.moveAllUnits();
+
+    std::lock_guard<std::mutex> lck(_messageQueueLock);
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++)
+        _restPositions[i] = _multiStepper.getUnitPosition(i);
+}
+
+#ifdef CONFIG_UNITS_IDLE_PARK
+void Display::parkWhenIdle() {
+    if (_parked || getTimeUs() - _readyAtUs < CONFIG_UNITS_IDLE_PARK_TIMEOUT_MS * 1000LL)
+        return;
+
+    // Only park once per idle period
+    _parked = true;
+
+    int parkLetters[CONFIG_UNITS_COUNT];
+    bool moving = false;
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        int position = getParkPosition(i, parkLetters[i]);
+        if (position < 0 || position == _multiStepper.getUnitPosition(i))
+            continue;
+
+        _multiStepper.setTargetPosition(i, position);
+        moving = true;
+    }
+
+    if (!moving)
+        return;
+
+    ESP_LOGI(TAG, "Parking idle units");
+    _multiStepper.moveAllUnits();
+
+    {
+        std::lock_guard<std::mutex> lck(_messageQueueLock);
+        for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+            _currentLetters[i] = parkLetters[i];
+            _restPositions[i] = _multiStepper.getUnitPosition(i);
+        }
+    }
+    updateState(nullptr);
+}
+
+int Display::getParkPosition(uint8_t unitNum, int &parkLetter) {
+    UnitCalibration &calibration = _unitCalibrations[unitNum];
+    int currentLetter = _currentLetters[unitNum];
+    parkLetter = currentLetter;
+
+    // Nothing to go on yet
+    if (_letterStats.getTotal(unitNum) == 0)
+        return -1;
+
+#ifdef CONFIG_UNITS_IDLE_PARK_HOLD_CONTENT
+    // Within the flap that's showing, the end of it is closest to every other letter
+    if (currentLetter < 0)
+        return -1;
+
+    int stagePosition = calibration.getStagePosition(currentLetter);
+    return _multiStepper.getUnitPosition(unitNum) < stagePosition ? stagePosition : -1;
+#else
+    // Any flap will do, so find the one with the least expected travel to the next letter
+    // The end of each flap is always the best spot within it
+    int bestPosition = -1;
+    uint64_t bestCost = UINT64_MAX;
+    int lettersCount = calibration.getLettersCount();
+    for (int i = 0; i < lettersCount; i++) {
+        // Check the current letter first, so it wins any ties and the unit doesn't move for nothing
+        int letterNum = currentLetter < 0 ? i : (currentLetter + i) % lettersCount;
+        int position = calibration.getStagePosition(letterNum);
+
+        uint64_t cost = 0;
+        for (int next = 0; next < lettersCount; next++) {
+            uint16_t weight = _letterStats.getCount(unitNum, next);
+            if (weight == 0)
+                continue;
+
+            // Repeated letters will go to whichever copy is nearest from here
+            int nextLetter = calibration.getLetterNumForGlyph(calibration.getGlyphForLetterNum(next), letterNum);
+            if (nextLetter == letterNum)
+                continue;
+
+            cost += (uint64_t)weight * MotionEstimator::stepsBetween(position, calibration.getPosition(nextLetter), _rotationSteps[unitNum]);
+        }
+
+        if (cost < bestCost) {
+            bestCost = cost;
+            bestPosition = position;
+            parkLetter = letterNum;
+        }
+    }
+
+    // Already parked further into the flap it's showing
+    if (parkLetter == currentLetter && _multiStepper.getUnitPosition(unitNum) >= bestPosition)
+        return -1;
+
+    return bestPosition;
+#endif
+}
+#endif
+
 void Display::initUnits() {
     ESP_LOGI(TAG, "Homing Units");
-
+    bootStageStart(BOOT_STAGE_HOMING);
     _multiStepper.home();
+    bootStageDone(BOOT_STAGE_HOMING);
+
+    // Calibration is done over the API, so never hold up boot for it
+    ESP_LOGI(TAG, "Loading Calibration");
+    bootStageStart(BOOT_STAGE_CALIBRATION);
+    _calibrate.load();
+    bootStageDone(BOOT_STAGE_CALIBRATION);
 
-    ESP_LOGI(TAG, "Calibrating Units");
-    Calibrate calibrate(&_multiStepper);
-    calibrate.calibrate();
-    calibrate.populateCalibrations(_unitCalibrations, CONFIG_UNITS_COUNT);
+    // Homing leaves the units at home, so nothing is known to be showing
+    std::lock_guard<std::mutex> lck(_messageQueueLock);
+    _calibrate.populateCalibrations(_unitCalibrations, CONFIG_UNITS_COUNT);
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        _currentLetters[i] = -1;
+        _restPositions[i] = _multiStepper.getUnitPosition(i);
+        _multiStepper.setStepInterval(i, _unitCalibrations[i].getStepInterval());
+    }
+    updateRotationSteps();
+    updateState(nullptr);
 }
+
+static int64_t getTimeUs() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (int64_t)now.tv_sec * 1000000LL + now.tv_usec;
+}
\ No newline at end of file
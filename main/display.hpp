@@ -4,37 +4,212 @@
 #include "calibrate.hpp"
 #include "config.h"
 #include "letters.hpp"
+#include "glyphs.hpp"
+#include "motionestimator.hpp"
+#include "letterstats.hpp"
+#include "displaytypes.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include <mutex>
 #include <atomic>
 #include <thread>
-#include <queue>
+#include <deque>
 
+// One step of an animation, see keyframes.hpp for how they're streamed in
 typedef struct {
-    char message[unitLettersCount];
-    long long minShowMs;
-} DisplayMessage_t;
+    // Step position for each unit to move to, keyframeKeep to leave it where it is
+    uint16_t targets[CONFIG_UNITS_COUNT];
+    // One step every this many step delays, 0 or anything faster than the unit's calibrated speed gives that speed
+    uint8_t stepIntervals[CONFIG_UNITS_COUNT];
+    // Once every unit has landed, before the next keyframe
+    uint16_t holdMs;
+    // Marks the end of the stream, the rest is ignored
+    bool end;
+} Keyframe_t;
+
+enum class DisplayEventType {
+    Mode,               // Mode changed
+    Queue,              // Queue length changed
+    Message,            // Message taken off the queue to be shown
+    MotionStarted,      // Units started moving for the message
+    UnitArrived,        // A unit that moved for the message has landed
+    MotionDone,         // Every unit has landed
+    AnimationStarted,   // Units started playing keyframes
+    AnimationDone       // Last keyframe played, units are left wherever it took them
+};
+
+typedef struct {
+    DisplayEventType type;
+    DisplayMode mode;
+    size_t queueLength;
+    // Message being shown, for message and motion events
+    const DisplayMessage_t *message;
+    // Unit that landed, for unit arrived events
+    uint8_t unitNum;
+    // Units that move for the message and the steps they take between them, for message and motion events
+    int changedUnits;
+    int steps;
+} DisplayEvent_t;
+
+// Called from whichever thread made the change, possibly while holding Display locks
+// Must be quick, and must not call back into Display
+typedef void (*DisplayEventFn)(void *context, const DisplayEvent_t &event);
 
 class Display {
     public:
         Display(MultiStepper &multiStepper);
         ~Display();
 
+        // Most messages that can be waiting to be shown
+        static const size_t maxQueueLength = 10;
+        // Furthest ahead of the wall clock a message can be scheduled to land
+        static const int64_t maxShowAtAheadUs = 60LL * 60 * 1000 * 1000;
+
+        // Convert a time to land at, in milliseconds since the epoch, returns false if it's negative or further ahead
+        // than maxShowAtAheadUs, e.g. from a client whose clock is set when ours isn't yet
+        static bool getShowAtUs(double showAtMs, int64_t &showAtUs);
+
         void start();
         void stop();
-        bool enqueueMessage(DisplayMessage_t message);
+        // Queue a message, eta is populated with the predicted timings and messageId with its id if provided
+        bool enqueueMessage(DisplayMessage_t message, MessageEta_t *eta = nullptr, uint32_t *messageId = nullptr);
+        // Queue every message or none of them if there isn't room, etas is populated for each message if provided
+        // A message replaced by a later one in the same batch gets the timings of its replacement
+        bool enqueueMessages(const DisplayMessage_t *messages, size_t count, MessageEta_t *etas = nullptr);
+        // Queue a message so that every unit finishes moving at showAtUs (wall clock, microseconds since the epoch)
+        bool showAt(DisplayMessage_t message, int64_t showAtUs);
         void clearQueue();
+
+        // Fill timeline, which must have room for maxQueueLength, with every queued message in order and its
+        // predicted timings, returns how many there are
+        size_t getQueueTimeline(QueuedMessage_t *timeline);
+        // Predict how long until there's room to queue count more messages, in microseconds
+        // 0 if there's room already, -1 if there never will be
+        int64_t getRoomWaitUs(size_t count);
+
+        // Copy the letter transition counts, across all units, into a unitLettersCount x unitLettersCount matrix
+        void getLetterTransitions(uint16_t *transitions);
+
+        // Queue a calibration command, run by the worker between messages, returns false if invalid
+        bool calibrate(CalibrationCommand_t command);
+        // Queue every command, or none of them if any is invalid
+        bool calibrate(const CalibrationCommand_t *commands, size_t count);
+        CalibrationStatus_t getCalibrationStatus(uint8_t unitNum);
+        bool calibrationComplete();
         bool ready() { return _active.load() && _ready.load(); }
 
+        // Play keyframes from the queue once the message showing is done, ahead of any queued messages
+        // Ends on an end keyframe, or if none comes for a while, returns false if an animation is already playing
+        bool playAnimation(QueueHandle_t keyframes);
+        bool animating() { return _animationKeyframes.load() != nullptr; }
+
+        // Have fn called on every state change, returns false if there are too many listeners
+        // Listeners can't be removed, so context must outlive the display
+        bool addEventListener(DisplayEventFn fn, void *context);
+        void publishEvent(const DisplayEvent_t &event);
+
+        // Copy the latest state, never waits on the worker
+        void getState(DisplayState_t &state);
+        // Version of the latest state, cheaper than getState when that's all that's needed
+        uint32_t getStateVersion() { return _stateSequence.load() / 2; }
+
     private:
+        static const int maxEventListeners = 4;
+
         void worker();
         void initUnits();
 
+        // Publish the queue length, must hold _messageQueueLock
+        void publishQueueLength();
+
+        // Apply a change to the state, or with no event refresh the units after they've moved, see _stateSequence
+        // Anything other than mode and queue changes must come from the worker
+        void updateState(const DisplayEvent_t *event);
+        void updateUnitState(uint8_t unitNum);
+
+        static void unitArrivedC(void *context, uint8_t unitNum) { ((Display*)context)->unitArrived(unitNum); }
+        void unitArrived(uint8_t unitNum);
+
+        // Move the units through each keyframe as it comes, then work out what they're showing
+        void animate(QueueHandle_t keyframes);
+
+        // Run any queued calibration commands, returns true if units are being calibrated and can't show messages
+        bool processCalibration();
+
+        // Start the estimator from where the units will be once the worker is free, must hold _messageQueueLock
+        // Returns when that is
+        int64_t resetEstimator();
+
+        // Get the id for a message being queued, never 0, must hold _messageQueueLock
+        uint32_t nextMessageId();
+
+        // Get where a message would go in the queue, replacing any queued message with the same key, or else
+        // inserted after the last message of at least its priority, must hold _messageQueueLock
+        size_t findQueuePosition(const DisplayMessage_t &message, bool &replaces);
+
+        // Set the unit targets for a message, must hold _messageQueueLock
+        void planMove(const DisplayMessage_t &message);
+
+        // Store the rotation lengths measured while moving, falling back on calibration, must hold _messageQueueLock
+        void updateRotationSteps();
+
+        // Whether a message can be taken off the queue, scheduled messages wait at the front until they're nearly due
+        // so the worker keeps running meanwhile, must hold _messageQueueLock
+        bool isDue(const DisplayMessage_t &message);
+
+        // Stagger the start of each unit and wait, so all units arrive at showAtUs
+        void scheduleArrival(int64_t showAtUs);
+
+        // Keep the current message showing for holdMs, pre-staging the next message if enabled
+        void holdMessage(long long holdMs);
+
+        // Advance units within the flap they're showing, towards the letters of the next message
+        void prestage(const DisplayMessage_t &next);
+
+#ifdef CONFIG_UNITS_IDLE_PARK
+        // Once idle for long enough, park units where the next message is likely to be quickest
+        void parkWhenIdle();
+
+        // Get the position a unit should park at, and the letter it will show there
+        int getParkPosition(uint8_t unitNum, int &parkLetter);
+#endif
+
         MultiStepper &_multiStepper;
+        Calibrate _calibrate;
         UnitCalibration _unitCalibrations[CONFIG_UNITS_COUNT];
+        MotionEstimator _estimator;
+        LetterStats _letterStats;
+#ifdef CONFIG_UNITS_IDLE_PARK
+        bool _parked = false;
+#endif
+
+        uint32_t _lastMessageId = 0;
+        std::atomic<QueueHandle_t> _animationKeyframes = nullptr;
 
         std::atomic_bool _active = false;
         std::atomic_bool _ready = false;
         std::thread _workerThread;
+
+        // Listeners are only ever added, each one is set before the count is raised so readers need no lock
+        DisplayEventFn _eventListeners[maxEventListeners];
+        void *_eventContexts[maxEventListeners];
+        std::atomic_int _eventListenersCount = 0;
+        std::mutex _eventListenersLock;
+
+        // Seqlock over _state, odd while it's being written, readers retry if it was written while they copied it
+        std::atomic<uint32_t> _stateSequence = 0;
+        std::mutex _stateLock;
+        DisplayState_t _state;
+
+        // Message being moved to and which units are moving for it, only used by the worker
+        DisplayMessage_t _movingMessage;
+        bool _unitMoving[CONFIG_UNITS_COUNT];
+
+        // Guards the queue, and the worker state used to estimate it
         std::mutex _messageQueueLock;
-        std::queue<DisplayMessage_t> _messageQueue;
+        std::deque<DisplayMessage_t> _messageQueue;
+        int _currentLetters[CONFIG_UNITS_COUNT];
+        int _restPositions[CONFIG_UNITS_COUNT];
+        int _rotationSteps[CONFIG_UNITS_COUNT];
+        int64_t _readyAtUs = 0;
 };
\ No newline at end of file
@@ -1,6 +1,6 @@
 #include "displaymanager.hpp"
 #include "esp_log.h"
-#include <cstring>
+#include <stdio.h>
 
 static const char* TAG = "DISPLAYMANAGER";
 
@@ -32,9 +32,15 @@ void DisplayManager::switchMode(DisplayMode mode) {
             _clock->stop();
             break;
     }
+
+    DisplayEvent_t event = {};
+    event.type = DisplayEventType::Mode;
+    event.mode = mode;
+    _display.publishEvent(event);
 }
 
-bool DisplayManager::display(const char* message, int minDisplayMs) {
+bool DisplayManager::display(const char* message, int minDisplayMs, uint32_t coalesceKey, int64_t showAtUs, MessageEta_t *eta,
+    uint32_t *messageId) {
     std::lock_guard<std::mutex> lck(_accessLock);
 
     if (_mode != DisplayMode::Text) {
@@ -42,13 +48,124 @@ bool DisplayManager::display(const char* message, int minDisplayMs) {
         return false;
     }
 
-    int messageLen = strlen(message);
-    if (messageLen > CONFIG_UNITS_COUNT)
-        messageLen = CONFIG_UNITS_COUNT;
-
-    DisplayMessage_t displayMessage;
+    DisplayMessage_t displayMessage = {};
     displayMessage.minShowMs = minDisplayMs;
-    memset(displayMessage.message, 0, sizeof(char)*CONFIG_UNITS_COUNT);
-    memcpy(displayMessage.message, message, messageLen);
-    return _display.enqueueMessage(displayMessage);
+    displayMessage.coalesceKey = coalesceKey;
+    displayMessage.showAtUs = showAtUs;
+    decodeGlyphs(message, displayMessage.glyphs, CONFIG_UNITS_COUNT);
+    return _display.enqueueMessage(displayMessage, eta, messageId);
+}
+
+uint32_t DisplayManager::makeCoalesceKey(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (const char *c = name; *c != 0; c++) {
+        hash ^= (uint8_t)*c;
+        hash *= 16777619u;
+    }
+
+    return hash == 0 ? 1 : hash;
+}
+
+bool DisplayManager::makeCoalesceKey(double number, uint32_t &key) {
+    // Checked before converting, anything out of range doesn't convert
+    if (!(number >= 0 && number <= 4294967295.0) || number != (double)(uint32_t)number)
+        return false;
+
+    uint32_t value = (uint32_t)number;
+    if (value == 0) {
+        key = 0;
+        return true;
+    }
+
+    char name[12];
+    snprintf(name, sizeof(name), "%lu", (unsigned long)value);
+    key = makeCoalesceKey(name);
+    return true;
 }
+
+bool DisplayManager::displayGlyphs(const DisplayMessage_t &message) {
+    std::lock_guard<std::mutex> lck(_accessLock);
+
+    if (_mode != DisplayMode::Text) {
+        ESP_LOGW(TAG, "Message requested, but mode is not text");
+        return false;
+    }
+
+    return _display.enqueueMessage(message);
+}
+
+bool DisplayManager::displayBatch(const MessageRequest_t *requests, size_t count, MessageEta_t *etas) {
+    std::lock_guard<std::mutex> lck(_accessLock);
+
+    if (_mode != DisplayMode::Text) {
+        ESP_LOGW(TAG, "Messages requested, but mode is not text");
+        return false;
+    }
+
+    if (count > Display::maxQueueLength)
+        return false;
+
+    DisplayMessage_t displayMessages[Display::maxQueueLength] = {};
+    for (size_t i = 0; i < count; i++) {
+        displayMessages[i].minShowMs = requests[i].minDisplayMs;
+        displayMessages[i].coalesceKey = requests[i].coalesceKey;
+        displayMessages[i].showAtUs = requests[i].showAtUs;
+        decodeGlyphs(requests[i].message, displayMessages[i].glyphs, CONFIG_UNITS_COUNT);
+    }
+    return _display.enqueueMessages(displayMessages, count, etas);
+}
+
+bool DisplayManager::playAnimation(QueueHandle_t keyframes) {
+    std::lock_guard<std::mutex> lck(_accessLock);
+
+    if (_mode != DisplayMode::Text) {
+        ESP_LOGW(TAG, "Animation requested, but mode is not text");
+        return false;
+    }
+
+    return _display.playAnimation(keyframes);
+}
+
+bool DisplayManager::animating() {
+    return _display.animating();
+}
+
+size_t DisplayManager::getQueueTimeline(QueuedMessage_t *timeline) {
+    return _display.getQueueTimeline(timeline);
+}
+
+int64_t DisplayManager::getRoomWaitUs(size_t count) {
+    return _display.getRoomWaitUs(count);
+}
+
+void DisplayManager::getLetterTransitions(uint16_t *transitions) {
+    _display.getLetterTransitions(transitions);
+}
+
+void DisplayManager::getState(DisplayState_t &state) {
+    _display.getState(state);
+}
+
+uint32_t DisplayManager::getStateVersion() {
+    return _display.getStateVersion();
+}
+
+bool DisplayManager::addEventListener(DisplayEventFn fn, void *context) {
+    return _display.addEventListener(fn, context);
+}
+
+bool DisplayManager::calibrate(CalibrationCommand_t command) {
+    return _display.calibrate(command);
+}
+
+bool DisplayManager::calibrate(const CalibrationCommand_t *commands, size_t count) {
+    return _display.calibrate(commands, count);
+}
+
+CalibrationStatus_t DisplayManager::getCalibrationStatus(uint8_t unitNum) {
+    return _display.getCalibrationStatus(unitNum);
+}
+
+bool DisplayManager::calibrationComplete() {
+    return _display.calibrationComplete();
+}
\ No newline at end of file
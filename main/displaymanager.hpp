@@ -2,13 +2,17 @@
 
 #include "Display.hpp"
 #include "clock.hpp"
+#include <atomic>
 #include <memory>
 #include <mutex>
 
-enum class DisplayMode {
-    Clock,
-    Text
-};
+// One message of a batch, as it would be passed to display()
+typedef struct {
+    const char* message;
+    int minDisplayMs;
+    uint32_t coalesceKey;
+    int64_t showAtUs;
+} MessageRequest_t;
 
 class DisplayManager {
     public:
@@ -16,11 +20,51 @@ class DisplayManager {
         ~DisplayManager();
 
         void switchMode(DisplayMode mode);
-        bool display(const char* message, int minDisplayMs);
+        DisplayMode getMode() { return _mode; }
+        // Queue a UTF-8 message for display, eta is populated with the predicted timings and messageId with the id
+        // its events will carry if provided
+        bool display(const char* message, int minDisplayMs, uint32_t coalesceKey = 0, int64_t showAtUs = 0, MessageEta_t *eta = nullptr,
+            uint32_t *messageId = nullptr);
+        // Turn a string into a coalescing key, never 0 as that's reserved for 'never coalesce'
+        static uint32_t makeCoalesceKey(const char *name);
+        // Turn a number into a coalescing key, hashed like its decimal string so it can't land on the keys used
+        // internally, returns false unless it's a whole number from 0 to 4294967295, 0 still never coalesces
+        static bool makeCoalesceKey(double number, uint32_t &key);
+
+        // Queue a message that's already glyphs, with its own priority
+        bool displayGlyphs(const DisplayMessage_t &message);
+        // Queue every message in order, or none of them if there isn't room, etas is populated for each message if provided
+        bool displayBatch(const MessageRequest_t *requests, size_t count, MessageEta_t *etas = nullptr);
+
+        // Play keyframes from the queue, see Display::playAnimation, text mode only
+        bool playAnimation(QueueHandle_t keyframes);
+        bool animating();
+
+        // Fill timeline with every queued message and its predicted timings, see Display::getQueueTimeline
+        size_t getQueueTimeline(QueuedMessage_t *timeline);
+        // Predict how long until there's room to queue count more messages, see Display::getRoomWaitUs
+        int64_t getRoomWaitUs(size_t count);
+
+        // Copy the letter transition counts into a unitLettersCount x unitLettersCount matrix
+        void getLetterTransitions(uint16_t *transitions);
+
+        // Latest display state, see DisplayState_t
+        void getState(DisplayState_t &state);
+        uint32_t getStateVersion();
+
+        // Have fn called on every change to the display or its queue, see DisplayEventFn
+        bool addEventListener(DisplayEventFn fn, void *context);
+
+        // Queue a calibration command, works in any mode
+        bool calibrate(CalibrationCommand_t command);
+        // Queue every command, or none of them if any is invalid
+        bool calibrate(const CalibrationCommand_t *commands, size_t count);
+        CalibrationStatus_t getCalibrationStatus(uint8_t unitNum);
+        bool calibrationComplete();
 
     private:
         Display &_display;
         std::unique_ptr<Clock> _clock;
         std::mutex _accessLock;
-        DisplayMode _mode = DisplayMode::Text;
+        std::atomic<DisplayMode> _mode = DisplayMode::Text;
 };
\ No newline at end of file
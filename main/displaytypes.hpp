@@ -0,0 +1,75 @@
+#pragma once
+
+#include "sdkconfig.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// What the display is showing and has queued, as passed to the API
+// Plain data free of ESP-IDF, so host tools can include it too
+
+typedef struct {
+    // Wall clock times in microseconds since the epoch
+    int64_t startUs;    // Units start moving
+    int64_t arrivalUs;  // Last unit lands
+    int64_t releaseUs;  // Minimum display time is over, next message can start
+    int travelSteps;    // Step delays taken by the slowest unit, one per step unless speed limited
+    int totalSteps;     // Steps taken across all units
+} MessageEta_t;
+
+// Leaves a unit to land on whichever flap has its glyph
+static const uint8_t noFlap = 255;
+
+typedef struct {
+    // Glyph for each unit, see glyphs.hpp
+    uint8_t glyphs[CONFIG_UNITS_COUNT];
+    // Flap on each unit's drum to land on instead, for units not set to noFlap, glyphs must still match them
+    bool hasFlaps;
+    uint8_t flaps[CONFIG_UNITS_COUNT];
+    long long minShowMs;
+    // Messages with the same non-zero key replace each other while queued, 0 never coalesces
+    uint32_t coalesceKey;
+    // Wall clock time in microseconds since the epoch that the message should land at, 0 to show immediately
+    int64_t showAtUs;
+    // Queued ahead of messages with a lower priority, 0 for the back of the queue
+    uint8_t priority;
+    // Set as it's queued, a message replacing a queued one takes its id
+    uint32_t id;
+} DisplayMessage_t;
+
+typedef struct {
+    DisplayMessage_t message;
+    MessageEta_t eta;
+} QueuedMessage_t;
+
+enum class DisplayMode {
+    Clock,
+    Text
+};
+
+inline const char *getDisplayModeName(DisplayMode mode) {
+    switch (mode) {
+        case DisplayMode::Clock: return "clock";
+        case DisplayMode::Text: return "text";
+    }
+    return "unknown";
+}
+
+typedef struct {
+    // Goes up by one on every change
+    uint32_t version;
+    DisplayMode mode;
+    // Message being shown, or moved to while moving
+    bool hasMessage;
+    uint8_t message[CONFIG_UNITS_COUNT];
+    bool moving;
+    size_t queueLength;
+    // What each unit has landed on, noGlyph if not known, and its position in steps
+    uint8_t unitGlyphs[CONFIG_UNITS_COUNT];
+    int unitPositions[CONFIG_UNITS_COUNT];
+    // Units moved and steps taken for the latest message, and totals since boot
+    int changedUnits;
+    int steps;
+    uint32_t messagesShown;
+    uint32_t messagesUnchanged;
+    uint64_t totalSteps;
+} DisplayState_t;
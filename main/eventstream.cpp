@@ -0,0 +1,315 @@
+#include "eventstream.hpp"
+#include "esp_log.h"
+#include "glyphs.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+static const char *TAG = "EVENTS";
+
+static const char *streamHeaders =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "retry: 2000\n\n";
+
+EventStream::EventStream() {
+    for (int i = 0; i < maxClients; i++)
+        _clients[i].socket = -1;
+    memset(_glyphs, 0, sizeof(_glyphs));
+}
+
+EventStream::~EventStream() {
+    stop();
+}
+
+void EventStream::start(httpd_handle_t server, DisplayMode mode) {
+    std::lock_guard<std::mutex> lck(_lock);
+    _server = server;
+    _mode = mode;
+
+    if (_timer == nullptr) {
+        const esp_timer_create_args_t timerArgs = {
+            .callback = &tickC,
+            .arg = this,
+            .name = "events_tick"
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timerArgs, &_timer));
+    }
+    esp_timer_start_periodic(_timer, 1000 * 1000);
+}
+
+void EventStream::stop() {
+    std::lock_guard<std::mutex> lck(_lock);
+    if (_timer != nullptr)
+        esp_timer_stop(_timer);
+
+    // The server closes the sockets itself
+    for (int i = 0; i < maxClients; i++)
+        _clients[i].socket = -1;
+    _clientsCount = 0;
+    _server = nullptr;
+}
+
+bool EventStream::addClient(httpd_req_t *request) {
+    std::lock_guard<std::mutex> lck(_lock);
+
+    // Capped well short of the server's open sockets, which keep room for ordinary requests beyond every client,
+    // so idle dashboards can't lock out everything else
+    Client_t *client = nullptr;
+    for (int i = 0; i < maxClients && client == nullptr; i++) {
+        if (_clients[i].socket < 0)
+            client = &_clients[i];
+    }
+    if (client == nullptr)
+        return false;
+
+    // Events are written straight to the socket from here on, so the headers can't go through httpd_resp_*
+    if (httpd_send(request, streamHeaders, strlen(streamHeaders)) < 0)
+        return false;
+
+    client->socket = httpd_req_to_sockfd(request);
+    client->length = 0;
+    client->overflowed = false;
+    _clientsCount++;
+    ESP_LOGI(TAG, "Client %d connected, %d watching", client->socket, _clientsCount);
+
+    // Start them off with where things are
+    client->length = formatState(client->buffer, clientBufferLength);
+    queueFlush();
+    return true;
+}
+
+void EventStream::removeClient(int socket) {
+    std::lock_guard<std::mutex> lck(_lock);
+    for (int i = 0; i < maxClients; i++) {
+        if (_clients[i].socket != socket)
+            continue;
+
+        _clients[i].socket = -1;
+        _clientsCount--;
+        ESP_LOGI(TAG, "Client %d disconnected, %d watching", socket, _clientsCount);
+    }
+}
+
+void EventStream::onDisplayEvent(const DisplayEvent_t &event) {
+    std::lock_guard<std::mutex> lck(_lock);
+
+    switch (event.type) {
+        case DisplayEventType::Mode:
+            _mode = event.mode;
+            break;
+        case DisplayEventType::Queue:
+            _queueLength = event.queueLength;
+            break;
+        case DisplayEventType::Message:
+            memcpy(_glyphs, event.message->glyphs, sizeof(_glyphs));
+            _hasMessage = true;
+            break;
+        case DisplayEventType::MotionStarted:
+            _moving = true;
+            break;
+        case DisplayEventType::MotionDone:
+        case DisplayEventType::AnimationDone:
+            _moving = false;
+            break;
+        case DisplayEventType::AnimationStarted:
+            _hasMessage = false;
+            _moving = true;
+            break;
+        case DisplayEventType::UnitArrived:
+            break;
+    }
+
+    // Nobody watching, so keeping the state is all there is to do
+    if (_clientsCount == 0)
+        return;
+
+    char text[maxEventLength];
+    size_t length = formatEvent(event, text, sizeof(text));
+    if (length == 0)
+        return;
+
+    append(text, length);
+    queueFlush();
+}
+
+size_t EventStream::formatEvent(const DisplayEvent_t &event, char *text, size_t size) {
+    const char *name = nullptr;
+    switch (event.type) {
+        case DisplayEventType::Mode: name = "mode"; break;
+        case DisplayEventType::Queue: name = "queue"; break;
+        case DisplayEventType::Message: name = "message"; break;
+        case DisplayEventType::MotionStarted:
+        case DisplayEventType::MotionDone: name = "motion"; break;
+        case DisplayEventType::UnitArrived: name = "arrival"; break;
+        case DisplayEventType::AnimationStarted:
+        case DisplayEventType::AnimationDone: name = "animation"; break;
+    }
+
+    // Room is kept for the blank line that ends the event
+    int headerLength = snprintf(text, size, "event: %s\ndata: ", name);
+    JsonWriter json(&text[headerLength], size - headerLength - 2);
+    json.beginObject();
+    switch (event.type) {
+        case DisplayEventType::Mode:
+            json.addString("mode", getDisplayModeName(event.mode));
+            break;
+
+        case DisplayEventType::Queue:
+            json.addInt("length", event.queueLength);
+            break;
+
+        case DisplayEventType::Message:
+        case DisplayEventType::MotionStarted:
+        case DisplayEventType::MotionDone: {
+            char message[(CONFIG_UNITS_COUNT * 4) + 1];
+            encodeGlyphs(event.message->glyphs, CONFIG_UNITS_COUNT, message, sizeof(message));
+            json.addString("message", message);
+            if (event.type == DisplayEventType::Message) {
+                json.addInt("minDisplayMs", event.message->minShowMs);
+                json.addInt("changedUnits", event.changedUnits);
+                json.addInt("steps", event.steps);
+            } else {
+                json.addBool("moving", event.type == DisplayEventType::MotionStarted);
+            }
+            break;
+        }
+
+        case DisplayEventType::AnimationStarted:
+        case DisplayEventType::AnimationDone:
+            json.addBool("playing", event.type == DisplayEventType::AnimationStarted);
+            break;
+
+        case DisplayEventType::UnitArrived: {
+            char letter[5];
+            encodeGlyphs(&event.message->glyphs[event.unitNum], 1, letter, sizeof(letter));
+            json.addInt("unit", event.unitNum);
+            json.addString("letter", letter);
+            break;
+        }
+    }
+    json.endObject();
+
+    if (!json.ok())
+        return 0;
+
+    size_t length = headerLength + json.getLength();
+    text[length++] = '\n';
+    text[length++] = '\n';
+    return length;
+}
+
+size_t EventStream::formatState(char *text, size_t size) {
+    int headerLength = snprintf(text, size, "event: state\ndata: ");
+    JsonWriter json(&text[headerLength], size - headerLength - 2);
+    json.beginObject();
+    json.addString("mode", getDisplayModeName(_mode));
+    if (_hasMessage) {
+        char message[(CONFIG_UNITS_COUNT * 4) + 1];
+        encodeGlyphs(_glyphs, CONFIG_UNITS_COUNT, message, sizeof(message));
+        json.addString("message", message);
+    } else {
+        json.addNull("message");
+    }
+    json.addBool("moving", _moving);
+    json.addInt("queueLength", _queueLength);
+    json.endObject();
+
+    if (!json.ok())
+        return 0;
+
+    size_t length = headerLength + json.getLength();
+    text[length++] = '\n';
+    text[length++] = '\n';
+    return length;
+}
+
+void EventStream::append(const char *text, size_t length) {
+    for (int i = 0; i < maxClients; i++) {
+        Client_t &client = _clients[i];
+        if (client.socket < 0 || client.overflowed)
+            continue;
+
+        // Fell behind, drop events until it catches up rather than let it hold up everyone else
+        if (client.length + length > clientBufferLength) {
+            client.overflowed = true;
+            continue;
+        }
+
+        memcpy(&client.buffer[client.length], text, length);
+        client.length += length;
+    }
+}
+
+void EventStream::queueFlush() {
+    if (_server == nullptr || _flushQueued.exchange(true))
+        return;
+
+    if (httpd_queue_work(_server, flushC, this) != ESP_OK)
+        _flushQueued = false;
+}
+
+void EventStream::flush() {
+    _flushQueued = false;
+
+    std::lock_guard<std::mutex> lck(_lock);
+    for (int i = 0; i < maxClients; i++) {
+        Client_t &client = _clients[i];
+        if (client.socket < 0 || client.length == 0)
+            continue;
+
+        // Never wait on a slow client, whatever doesn't go now is sent on a later flush
+        while (client.length > 0) {
+            int sent = httpd_socket_send(_server, client.socket, client.buffer, client.length, MSG_DONTWAIT);
+            if (sent == HTTPD_SOCK_ERR_TIMEOUT)
+                break;
+
+            if (sent < 0) {
+                ESP_LOGW(TAG, "Client %d send failed, closing", client.socket);
+                httpd_sess_trigger_close(_server, client.socket);
+                client.socket = -1;
+                client.length = 0;
+                _clientsCount--;
+                break;
+            }
+
+            client.length -= sent;
+            memmove(client.buffer, &client.buffer[sent], client.length);
+
+            // Caught up, so bring it up to date in one go
+            if (client.length == 0 && client.overflowed) {
+                client.overflowed = false;
+                client.length = formatState(client.buffer, clientBufferLength);
+            }
+        }
+    }
+}
+
+void EventStream::tick() {
+    std::lock_guard<std::mutex> lck(_lock);
+    if (_clientsCount == 0)
+        return;
+
+    bool pending = false;
+    bool keepAlive = ++_quietSeconds >= keepAliveSeconds;
+    if (keepAlive)
+        _quietSeconds = 0;
+
+    for (int i = 0; i < maxClients; i++) {
+        Client_t &client = _clients[i];
+        if (client.socket < 0)
+            continue;
+
+        if (keepAlive && client.length == 0) {
+            memcpy(client.buffer, ":\n\n", 3);
+            client.length = 3;
+        }
+        pending |= client.length > 0;
+    }
+
+    if (pending)
+        queueFlush();
+}
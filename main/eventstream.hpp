@@ -0,0 +1,79 @@
+#pragma once
+
+#include "esp_http_server.h"
+#include "esp_timer.h"
+#include "displaymanager.hpp"
+#include "jsonwriter.hpp"
+#include <atomic>
+#include <mutex>
+
+// Pushes display events to any number of clients as Server-Sent Events
+// Each event is formatted once and copied into a fixed buffer per client, then sent from the server task
+// A client too slow to keep up misses events until it catches up, then gets one state event with everything it missed
+class EventStream {
+    public:
+        EventStream();
+        ~EventStream();
+
+        // Start sending on server, mode is the display mode at the time
+        void start(httpd_handle_t server, DisplayMode mode);
+        void stop();
+
+        // Take over the connection of a GET request, returns false if there are already too many clients
+        bool addClient(httpd_req_t *request);
+        // Forget a client whose socket is closing
+        void removeClient(int socket);
+
+        static void onDisplayEventC(void *context, const DisplayEvent_t &event) { ((EventStream*)context)->onDisplayEvent(event); }
+
+        // Each client keeps its socket, so this counts against the server's open sockets
+        static const int maxClients = 4;
+
+    private:
+        static const size_t clientBufferLength = 2048;
+        static const size_t maxEventLength = 384;
+        // Seconds of quiet before a comment is sent, so dead connections are found and proxies don't time out
+        static const int keepAliveSeconds = 15;
+
+        typedef struct {
+            int socket;
+            size_t length;
+            // Events were dropped, so it's owed a state event once its buffer is empty
+            bool overflowed;
+            char buffer[clientBufferLength];
+        } Client_t;
+
+        void onDisplayEvent(const DisplayEvent_t &event);
+
+        // Write an event into text, returns its length, or 0 if it didn't fit, must hold _lock
+        size_t formatEvent(const DisplayEvent_t &event, char *text, size_t size);
+        size_t formatState(char *text, size_t size);
+
+        // Add text to every client's buffer, must hold _lock
+        void append(const char *text, size_t length);
+        // Get the server task to send whatever is buffered
+        void queueFlush();
+
+        static void flushC(void *context) { ((EventStream*)context)->flush(); }
+        void flush();
+
+        static void tickC(void *context) { ((EventStream*)context)->tick(); }
+        void tick();
+
+        httpd_handle_t _server = nullptr;
+        esp_timer_handle_t _timer = nullptr;
+        std::atomic_bool _flushQueued = false;
+
+        // Guards the clients and the state
+        std::mutex _lock;
+        Client_t _clients[maxClients];
+        int _clientsCount = 0;
+        int _quietSeconds = 0;
+
+        // Latest state, for new clients and ones that fell behind
+        DisplayMode _mode = DisplayMode::Text;
+        size_t _queueLength = 0;
+        uint8_t _glyphs[CONFIG_UNITS_COUNT];
+        bool _hasMessage = false;
+        bool _moving = false;
+};
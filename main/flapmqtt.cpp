@@ -0,0 +1,302 @@
+#include "flapmqtt.hpp"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "jsonwriter.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+static const char *TAG = "MQTT";
+
+// How often the state is checked for changes, and how often metrics go out
+static const int64_t publishIntervalUs = 500 * 1000;
+static const int64_t metricsIntervalUs = 60 * 1000 * 1000;
+
+FlapMqtt::FlapMqtt(DisplayManager &displayManager)
+    : _displayManager(displayManager) {
+
+}
+
+void FlapMqtt::start() {
+    if (_client != nullptr)
+        return;
+
+    snprintf(_messageTopic, maxTopicLength, "%s/message", CONFIG_MQTT_TOPIC);
+    snprintf(_modeTopic, maxTopicLength, "%s/mode", CONFIG_MQTT_TOPIC);
+    snprintf(_stateTopic, maxTopicLength, "%s/state", CONFIG_MQTT_TOPIC);
+    snprintf(_metricsTopic, maxTopicLength, "%s/metrics", CONFIG_MQTT_TOPIC);
+    snprintf(_onlineTopic, maxTopicLength, "%s/online", CONFIG_MQTT_TOPIC);
+    _fleetMessageTopic[0] = 0;
+    _fleetModeTopic[0] = 0;
+    if (strlen(CONFIG_MQTT_FLEET_TOPIC) > 0) {
+        snprintf(_fleetMessageTopic, maxTopicLength, "%s/message", CONFIG_MQTT_FLEET_TOPIC);
+        snprintf(_fleetModeTopic, maxTopicLength, "%s/mode", CONFIG_MQTT_FLEET_TOPIC);
+    }
+
+    const esp_timer_create_args_t reconnectTimerArgs = {
+        .callback = &reconnectC,
+        .arg = this,
+        .name = "mqtt_reconnect"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&reconnectTimerArgs, &_reconnectTimer));
+
+    const esp_timer_create_args_t publishTimerArgs = {
+        .callback = &publishC,
+        .arg = this,
+        .name = "mqtt_publish"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&publishTimerArgs, &_publishTimer));
+
+    // The broker says we're gone if we drop off without saying so
+    esp_mqtt_client_config_t config = {};
+    config.broker.address.uri = CONFIG_MQTT_BROKER_URI;
+    if (strlen(CONFIG_MQTT_USERNAME) > 0)
+        config.credentials.username = CONFIG_MQTT_USERNAME;
+    if (strlen(CONFIG_MQTT_PASSWORD) > 0)
+        config.credentials.authentication.password = CONFIG_MQTT_PASSWORD;
+    config.session.last_will.topic = _onlineTopic;
+    config.session.last_will.msg = "0";
+    config.session.last_will.msg_len = 1;
+    config.session.last_will.qos = CONFIG_MQTT_QOS;
+    config.session.last_will.retain = 1;
+
+    // Reconnects back off, rather than the client's fixed retry
+    config.network.disable_auto_reconnect = true;
+
+    _client = esp_mqtt_client_init(&config);
+    esp_mqtt_client_register_event(_client, MQTT_EVENT_ANY, eventHandlerC, this);
+    ESP_ERROR_CHECK(esp_mqtt_client_start(_client));
+    esp_timer_start_periodic(_publishTimer, publishIntervalUs);
+    ESP_LOGI(TAG, "Connecting to %s", CONFIG_MQTT_BROKER_URI);
+}
+
+void FlapMqtt::onEvent(esp_mqtt_event_handle_t event) {
+    switch (event->event_id) {
+        case MQTT_EVENT_CONNECTED:
+            onConnected();
+            break;
+        case MQTT_EVENT_DISCONNECTED:
+            onDisconnected();
+            break;
+        case MQTT_EVENT_DATA:
+            onData(event);
+            break;
+        case MQTT_EVENT_ERROR:
+            ESP_LOGW(TAG, "Error");
+            break;
+        default:
+            break;
+    }
+}
+
+void FlapMqtt::onConnected() {
+    ESP_LOGI(TAG, "Connected");
+    _reconnectDelayMs = minReconnectDelayMs;
+
+    esp_mqtt_client_subscribe(_client, _messageTopic, CONFIG_MQTT_QOS);
+    esp_mqtt_client_subscribe(_client, _modeTopic, CONFIG_MQTT_QOS);
+    if (_fleetMessageTopic[0] != 0) {
+        esp_mqtt_client_subscribe(_client, _fleetMessageTopic, CONFIG_MQTT_QOS);
+        esp_mqtt_client_subscribe(_client, _fleetModeTopic, CONFIG_MQTT_QOS);
+    }
+
+    esp_mqtt_client_enqueue(_client, _onlineTopic, "1", 1, CONFIG_MQTT_QOS, 1, true);
+
+    // The broker may have missed changes while we were away, so the state goes out again
+    _connected = true;
+}
+
+void FlapMqtt::onDisconnected() {
+    if (_connected.exchange(false))
+        _reconnects++;
+
+    ESP_LOGW(TAG, "Disconnected, retrying in %d ms", _reconnectDelayMs);
+    esp_timer_start_once(_reconnectTimer, (uint64_t)_reconnectDelayMs * 1000);
+
+    _reconnectDelayMs *= 2;
+    if (_reconnectDelayMs > maxReconnectDelayMs)
+        _reconnectDelayMs = maxReconnectDelayMs;
+}
+
+void FlapMqtt::reconnect() {
+    esp_mqtt_client_reconnect(_client);
+}
+
+void FlapMqtt::onData(esp_mqtt_event_handle_t event) {
+    // Large payloads come in parts, only the first has the topic
+    if (event->current_data_offset == 0) {
+        _payloadTopic = getTopic(event->topic, event->topic_len);
+        _payloadRetained = event->retain;
+        if (event->total_data_len > (int)maxPayloadLength) {
+            ESP_LOGW(TAG, "Payload of %d bytes is too long", event->total_data_len);
+            _payloadTopic = Topic::None;
+        }
+    }
+
+    if (_payloadTopic == Topic::None)
+        return;
+
+    memcpy(&_payload[event->current_data_offset], event->data, event->data_len);
+    if (event->current_data_offset + event->data_len < event->total_data_len)
+        return;
+
+    _payload[event->total_data_len] = 0;
+    _received++;
+    if (_payloadTopic == Topic::Message)
+        handleMessage(_payloadRetained);
+    else
+        handleMode();
+    _payloadTopic = Topic::None;
+}
+
+FlapMqtt::Topic FlapMqtt::getTopic(const char *topic, int length) {
+    auto matches = [&](const char *expected) {
+        return expected[0] != 0 && strlen(expected) == (size_t)length && strncmp(topic, expected, length) == 0;
+    };
+
+    if (matches(_messageTopic) || matches(_fleetMessageTopic))
+        return Topic::Message;
+    if (matches(_modeTopic) || matches(_fleetModeTopic))
+        return Topic::Mode;
+    return Topic::None;
+}
+
+void FlapMqtt::handleMessage(bool retained) {
+    // Either the same JSON as POST /api/message, or just the text
+    const char *text = _payload;
+    DisplayMessage_t message = {};
+    bool hasKey = false;
+    if (_payload[0] == '{') {
+        if (!_json.parse(_payload, strlen(_payload)) || !_json.isString(_json.get("message"))) {
+            ESP_LOGW(TAG, "Invalid message");
+            _rejected++;
+            return;
+        }
+
+        text = _json.getString(_json.get("message"));
+        message.minShowMs = _json.getInt(_json.get("minDisplayMs"));
+        int showAt = _json.get("showAtMs");
+        if (_json.isNumber(showAt) && !Display::getShowAtUs(_json.getNumber(showAt), message.showAtUs)) {
+            ESP_LOGW(TAG, "Invalid showAtMs");
+            _rejected++;
+            return;
+        }
+
+        int key = _json.get("key");
+        hasKey = _json.isNumber(key) || _json.isString(key);
+        if (_json.isNumber(key) && !DisplayManager::makeCoalesceKey(_json.getNumber(key), message.coalesceKey)) {
+            ESP_LOGW(TAG, "Invalid key");
+            _rejected++;
+            return;
+        }
+        if (_json.isString(key))
+            message.coalesceKey = DisplayManager::makeCoalesceKey(_json.getString(key));
+    }
+
+    // Updates that come quicker than the display can show them replace each other while queued, so a
+    // burst, like the retained messages sent on connecting, ends up as one motion to the latest
+    if (!hasKey)
+        message.coalesceKey = DisplayManager::makeCoalesceKey("mqtt");
+    decodeGlyphs(text, message.glyphs, CONFIG_UNITS_COUNT);
+
+    // Reconnecting gets the retained message again, no need to show it twice
+    if (retained) {
+        DisplayState_t state;
+        _displayManager.getState(state);
+        if (state.hasMessage && !state.moving && state.queueLength == 0 &&
+            memcmp(state.message, message.glyphs, sizeof(message.glyphs)) == 0) {
+            _skipped++;
+            return;
+        }
+    }
+
+    if (!_displayManager.displayGlyphs(message)) {
+        _rejected++;
+        return;
+    }
+
+    _shown++;
+}
+
+void FlapMqtt::handleMode() {
+    // Either {"mode": "clock"} or just clock, in any case
+    const char *mode = _payload;
+    if (_payload[0] == '{' && _json.parse(_payload, strlen(_payload)))
+        mode = _json.getString(_json.get("mode"), "");
+
+    if (strcasecmp(mode, "text") == 0) {
+        _displayManager.switchMode(DisplayMode::Text);
+    } else if (strcasecmp(mode, "clock") == 0) {
+        _displayManager.switchMode(DisplayMode::Clock);
+    } else {
+        ESP_LOGW(TAG, "Unsupported mode: %s", mode);
+        _rejected++;
+    }
+}
+
+void FlapMqtt::publish() {
+    if (!_connected.load()) {
+        _statePublished = false;
+        return;
+    }
+
+    if (!_statePublished || _displayManager.getStateVersion() != _publishedVersion)
+        publishState();
+
+    int64_t nowUs = esp_timer_get_time();
+    if (nowUs >= _metricsAtUs) {
+        _metricsAtUs = nowUs + metricsIntervalUs;
+        publishMetrics();
+    }
+}
+
+void FlapMqtt::publishState() {
+    DisplayState_t state;
+    _displayManager.getState(state);
+
+    JsonWriter json(_publishBuffer, sizeof(_publishBuffer));
+    json.beginObject();
+    json.addInt("version", state.version);
+    json.addString("mode", getDisplayModeName(state.mode));
+    if (state.hasMessage) {
+        char text[(CONFIG_UNITS_COUNT * 4) + 1];
+        encodeGlyphs(state.message, CONFIG_UNITS_COUNT, text, sizeof(text));
+        json.addString("message", text);
+    } else {
+        json.addNull("message");
+    }
+    json.addBool("moving", state.moving);
+    json.addInt("queueLength", state.queueLength);
+    json.endObject();
+
+    // Queued in the client's outbox, so this never waits on the network
+    if (!json.ok() || esp_mqtt_client_enqueue(_client, _stateTopic, json.getText(), json.getLength(), CONFIG_MQTT_QOS, 1, true) < 0)
+        return;
+
+    _publishedVersion = state.version;
+    _statePublished = true;
+}
+
+void FlapMqtt::publishMetrics() {
+    DisplayState_t state;
+    _displayManager.getState(state);
+
+    JsonWriter json(_publishBuffer, sizeof(_publishBuffer));
+    json.beginObject();
+    json.addInt("uptimeMs", esp_timer_get_time() / 1000);
+    json.addInt("freeHeap", esp_get_free_heap_size());
+    json.addInt("minFreeHeap", esp_get_minimum_free_heap_size());
+    json.addInt("stateVersion", state.version);
+    json.addInt("messagesShown", state.messagesShown);
+    json.addInt("messagesUnchanged", state.messagesUnchanged);
+    json.addInt("totalSteps", state.totalSteps);
+    json.addInt("received", _received.load());
+    json.addInt("shown", _shown.load());
+    json.addInt("skipped", _skipped.load());
+    json.addInt("rejected", _rejected.load());
+    json.addInt("reconnects", _reconnects.load());
+    json.endObject();
+
+    if (json.ok())
+        esp_mqtt_client_enqueue(_client, _metricsTopic, json.getText(), json.getLength(), 0, 0, true);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "mqtt_client.h"
+#include "esp_timer.h"
+#include "displaymanager.hpp"
+#include "jsonreader.hpp"
+#include <atomic>
+
+// Takes messages and mode changes from an MQTT broker, and publishes the display state and metrics back
+// See CONFIG_MQTT for the topics
+class FlapMqtt {
+    public:
+        FlapMqtt(DisplayManager &displayManager);
+
+        // Connect to the broker, reconnecting whenever the connection drops
+        void start();
+
+    private:
+        static const size_t maxTopicLength = 128;
+        static const size_t maxPayloadLength = 1024;
+        static const int minReconnectDelayMs = 1000;
+        static const int maxReconnectDelayMs = 60 * 1000;
+
+        enum class Topic {
+            None,
+            Message,
+            Mode
+        };
+
+        static void eventHandlerC(void *context, esp_event_base_t base, int32_t eventId, void *eventData) {
+            ((FlapMqtt*)context)->onEvent((esp_mqtt_event_handle_t)eventData);
+        }
+        void onEvent(esp_mqtt_event_handle_t event);
+        void onConnected();
+        void onDisconnected();
+
+        // Collect the payload, which may come in parts, and handle it once it's all there
+        void onData(esp_mqtt_event_handle_t event);
+        Topic getTopic(const char *topic, int length);
+        void handleMessage(bool retained);
+        void handleMode();
+
+        static void reconnectC(void *context) { ((FlapMqtt*)context)->reconnect(); }
+        void reconnect();
+
+        // Publish the state whenever it changes, and metrics now and then
+        static void publishC(void *context) { ((FlapMqtt*)context)->publish(); }
+        void publish();
+        void publishState();
+        void publishMetrics();
+
+        DisplayManager &_displayManager;
+        esp_mqtt_client_handle_t _client = nullptr;
+        esp_timer_handle_t _reconnectTimer = nullptr;
+        esp_timer_handle_t _publishTimer = nullptr;
+        std::atomic_bool _connected = false;
+        int _reconnectDelayMs = minReconnectDelayMs;
+
+        char _messageTopic[maxTopicLength];
+        char _modeTopic[maxTopicLength];
+        char _fleetMessageTopic[maxTopicLength];
+        char _fleetModeTopic[maxTopicLength];
+        char _stateTopic[maxTopicLength];
+        char _metricsTopic[maxTopicLength];
+        char _onlineTopic[maxTopicLength];
+
+        // Payload being collected, only touched on the MQTT task
+        Topic _payloadTopic = Topic::None;
+        bool _payloadRetained = false;
+        char _payload[maxPayloadLength + 1];
+        JsonReader _json;
+
+        // Only touched on the timer task
+        uint32_t _publishedVersion = 0;
+        bool _statePublished = false;
+        int64_t _metricsAtUs = 0;
+        char _publishBuffer[512];
+
+        std::atomic<uint32_t> _received = 0;
+        std::atomic<uint32_t> _shown = 0;
+        std::atomic<uint32_t> _skipped = 0;
+        std::atomic<uint32_t> _rejected = 0;
+        std::atomic<uint32_t> _reconnects = 0;
+};
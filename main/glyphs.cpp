@@ -0,0 +1,117 @@
+#include "glyphs.hpp"
+#include "esp_log.h"
+
+static const char *TAG = "GLYPHS";
+
+// Decode the UTF-8 sequence at message, setting length to the number of bytes used
+// Returns 0 at the end of the string
+static char32_t decodeUtf8(const char *message, int &length);
+
+int decodeGlyphs(const char *message, uint8_t *glyphs, size_t glyphsLen) {
+    int unsupported = 0;
+    size_t glyphNum = 0;
+
+    while (glyphNum < glyphsLen) {
+        int length = 0;
+        char32_t codePoint = decodeUtf8(message, length);
+        if (codePoint == 0)
+            break;
+        message += length;
+
+        uint8_t glyph = getGlyph(codePoint);
+        if (glyph == noGlyph) {
+            ESP_LOGW(TAG, "Unsupported character U+%04X", (unsigned int)codePoint);
+            ++unsupported;
+            glyph = blankGlyph;
+        }
+
+        glyphs[glyphNum++] = glyph;
+    }
+
+    while (glyphNum < glyphsLen)
+        glyphs[glyphNum++] = blankGlyph;
+
+    return unsupported;
+}
+
+size_t encodeGlyphs(const uint8_t *glyphs, size_t glyphsLen, char *buf, size_t bufLen) {
+    size_t len = 0;
+    for (size_t i = 0; i < glyphsLen; i++) {
+        char encoded[4];
+        size_t encodedLen = encodeUtf8(glyphs[i] < unitLettersCount ? unitLetters[glyphs[i]] : U'?', encoded);
+        if (len + encodedLen >= bufLen)
+            break;
+
+        for (size_t j = 0; j < encodedLen; j++)
+            buf[len++] = encoded[j];
+    }
+
+    if (bufLen > 0)
+        buf[len] = 0;
+    return len;
+}
+
+size_t encodeUtf8(char32_t codePoint, char *buf) {
+    if (codePoint < 0x80) {
+        buf[0] = codePoint;
+        return 1;
+    }
+
+    if (codePoint < 0x800) {
+        buf[0] = 0xC0 | (codePoint >> 6);
+        buf[1] = 0x80 | (codePoint & 0x3F);
+        return 2;
+    }
+
+    if (codePoint < 0x10000) {
+        buf[0] = 0xE0 | (codePoint >> 12);
+        buf[1] = 0x80 | ((codePoint >> 6) & 0x3F);
+        buf[2] = 0x80 | (codePoint & 0x3F);
+        return 3;
+    }
+
+    buf[0] = 0xF0 | (codePoint >> 18);
+    buf[1] = 0x80 | ((codePoint >> 12) & 0x3F);
+    buf[2] = 0x80 | ((codePoint >> 6) & 0x3F);
+    buf[3] = 0x80 | (codePoint & 0x3F);
+    return 4;
+}
+
+static char32_t decodeUtf8(const char *message, int &length) {
+    uint8_t lead = message[0];
+    length = 1;
+    if (lead < 0x80)
+        return lead;
+
+    int continuations = 0;
+    char32_t codePoint = 0;
+    if ((lead & 0xE0) == 0xC0) {
+        continuations = 1;
+        codePoint = lead & 0x1F;
+    } else if ((lead & 0xF0) == 0xE0) {
+        continuations = 2;
+        codePoint = lead & 0x0F;
+    } else if ((lead & 0xF8) == 0xF0) {
+        continuations = 3;
+        codePoint = lead & 0x07;
+    } else {
+        // Stray continuation byte or invalid lead, so not UTF-8
+        return lead;
+    }
+
+    for (int i = 1; i <= continuations; i++) {
+        uint8_t next = message[i];
+        if ((next & 0xC0) != 0x80)
+            return lead;
+        codePoint = (codePoint << 6) | (next & 0x3F);
+    }
+
+    // Overlong encodings, e.g. C0 80 for a null, could otherwise smuggle in characters, and surrogates and
+    // anything past U+10FFFF aren't characters at all
+    static const char32_t minCodePoints[] = {0, 0x80, 0x800, 0x10000};
+    if (codePoint < minCodePoints[continuations] || (codePoint >= 0xD800 && codePoint <= 0xDFFF) || codePoint > 0x10FFFF)
+        return lead;
+
+    length = continuations + 1;
+    return codePoint;
+}
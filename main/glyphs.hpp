@@ -0,0 +1,155 @@
+#pragma once
+
+#include "letters.hpp"
+#include "sdkconfig.h"
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+
+// Messages are carried as glyphs rather than characters, a glyph being the first flap in unitLetters that
+// shows a character, so any repeated letters share a glyph
+// Each unit's flap set then has a lookup from glyph to its own flaps
+static_assert(unitLettersCount < 255, "Glyphs are stored in a byte, with 255 reserved");
+
+// Marks a character that no flap can show
+const uint8_t noGlyph = 255;
+
+// Find the glyph for a code point, upper casing where the flaps only have upper case
+constexpr uint8_t findGlyph(char32_t codePoint) {
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < unitLettersCount; i++) {
+            if (unitLetters[i] == codePoint)
+                return i;
+        }
+
+        // a-z, and the Latin-1 lower case letters
+        bool lowerCase = (codePoint >= U'a' && codePoint <= U'z') || (codePoint >= 0xE0 && codePoint <= 0xFE && codePoint != 0xF7);
+        if (!lowerCase)
+            break;
+        codePoint -= 0x20;
+    }
+
+    return noGlyph;
+}
+
+constexpr std::array<uint8_t, 256> makeGlyphLookup() {
+    std::array<uint8_t, 256> lookup = {};
+    for (int i = 0; i < 256; i++)
+        lookup[i] = findGlyph(i);
+    return lookup;
+}
+
+// Most flaps on any drum
+constexpr int getMaxLettersCount() {
+    int maxLettersCount = 0;
+    for (int i = 0; i < flapSetsCount; i++)
+        maxLettersCount = flapSets[i].lettersCount > maxLettersCount ? flapSets[i].lettersCount : maxLettersCount;
+    return maxLettersCount;
+}
+
+inline constexpr int maxLettersCount = getMaxLettersCount();
+
+// Get the flap set fitted to a unit, see CONFIG_UNITS_FLAP_SETS
+constexpr uint8_t getUnitFlapSet(int unitNum) {
+    const char *unitFlapSets = CONFIG_UNITS_FLAP_SETS;
+    for (int i = 0; i < unitNum; i++) {
+        if (unitFlapSets[i] == 0)
+            return 0;
+    }
+
+    char flapSet = unitFlapSets[unitNum];
+    return flapSet >= '0' && flapSet <= '9' ? flapSet - '0' : 0;
+}
+
+constexpr bool validUnitFlapSets() {
+    for (int i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        if (getUnitFlapSet(i) >= flapSetsCount)
+            return false;
+    }
+    return true;
+}
+
+static_assert(validUnitFlapSets(), "CONFIG_UNITS_FLAP_SETS uses a flap set that isn't in letters.hpp");
+
+typedef struct {
+    // Flap showing each glyph, noGlyph if the drum doesn't have it
+    uint8_t glyphLetters[unitLettersCount];
+    // Next flap round the drum showing the same letter as each flap, itself if there's only the one
+    uint8_t nextCopies[maxLettersCount];
+    // Flap to show for glyphs the drum doesn't have
+    uint8_t blankLetter;
+} FlapSetLookup_t;
+
+constexpr FlapSetLookup_t makeFlapSetLookup(const FlapSet_t &flapSet) {
+    FlapSetLookup_t lookup = {};
+    for (int glyph = 0; glyph < unitLettersCount; glyph++) {
+        lookup.glyphLetters[glyph] = noGlyph;
+        for (int i = 0; i < flapSet.lettersCount; i++) {
+            if (flapSet.letters[i] == unitLetters[glyph]) {
+                lookup.glyphLetters[glyph] = i;
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < flapSet.lettersCount; i++) {
+        lookup.nextCopies[i] = i;
+        for (int j = 1; j < flapSet.lettersCount; j++) {
+            int letterNum = (i + j) % flapSet.lettersCount;
+            if (flapSet.letters[letterNum] == flapSet.letters[i]) {
+                lookup.nextCopies[i] = letterNum;
+                break;
+            }
+        }
+    }
+
+    uint8_t blankGlyph = findGlyph(U' ');
+    lookup.blankLetter = blankGlyph == noGlyph || lookup.glyphLetters[blankGlyph] == noGlyph ? 0 : lookup.glyphLetters[blankGlyph];
+    return lookup;
+}
+
+constexpr bool validFlapSets() {
+    for (int i = 0; i < flapSetsCount; i++) {
+        if (flapSets[i].lettersCount >= 255)
+            return false;
+
+        for (int j = 0; j < flapSets[i].lettersCount; j++) {
+            if (findGlyph(flapSets[i].letters[j]) == noGlyph)
+                return false;
+        }
+    }
+    return true;
+}
+
+static_assert(validFlapSets(), "Every letter on a flap set must be in unitLetters, and sets must have fewer than 255 flaps");
+
+constexpr std::array<FlapSetLookup_t, flapSetsCount> makeFlapSetLookups() {
+    std::array<FlapSetLookup_t, flapSetsCount> lookups = {};
+    for (int i = 0; i < flapSetsCount; i++)
+        lookups[i] = makeFlapSetLookup(flapSets[i]);
+    return lookups;
+}
+
+// Glyph for each Latin-1 code point, built at compile time
+inline constexpr std::array<uint8_t, 256> glyphLookup = makeGlyphLookup();
+
+// Glyph to flap lookups for each flap set, built at compile time
+inline constexpr std::array<FlapSetLookup_t, flapSetsCount> flapSetLookups = makeFlapSetLookups();
+
+// Glyph shown when there's nothing to show
+inline constexpr uint8_t blankGlyph = glyphLookup[' '] == noGlyph ? 0 : glyphLookup[' '];
+
+inline uint8_t getGlyph(char32_t codePoint) {
+    return codePoint < glyphLookup.size() ? glyphLookup[codePoint] : findGlyph(codePoint);
+}
+
+// Decode a UTF-8 message into one glyph per unit, padding with blanks
+// Bytes that aren't valid UTF-8 are taken as Latin-1, unsupported characters show as blank
+// Returns the number of characters that couldn't be shown
+int decodeGlyphs(const char *message, uint8_t *glyphs, size_t glyphsLen);
+
+// Encode glyphs back into a null terminated UTF-8 string, returns the length without the null
+size_t encodeGlyphs(const uint8_t *glyphs, size_t glyphsLen, char *buf, size_t bufLen);
+
+// Encode a single code point as UTF-8, buf must have room for 4 bytes, returns the length
+size_t encodeUtf8(char32_t codePoint, char *buf);
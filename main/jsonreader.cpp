@@ -0,0 +1,308 @@
+#include "jsonreader.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include "glyphs.hpp"
+
+// What the parser is expecting next
+enum class Expect {
+    Value,
+    Key,
+    Colon,
+    Comma,
+    End
+};
+
+static bool isWhitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static bool parseHex4(const char *text, uint32_t &value) {
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hexValue(text[i]);
+        if (digit < 0)
+            return false;
+        value = (value << 4) | digit;
+    }
+    return true;
+}
+
+bool JsonReader::parse(char *text, size_t length) {
+    _text = text;
+    _count = 0;
+
+    // Containers still open, innermost last
+    int open[maxDepth];
+    int depth = 0;
+    Expect expect = Expect::Value;
+    size_t pos = 0;
+
+    while (true) {
+        while (pos < length && isWhitespace(text[pos]))
+            pos++;
+        if (pos >= length || text[pos] == 0)
+            break;
+
+        char c = text[pos];
+        int parent = depth > 0 ? open[depth - 1] : -1;
+        bool empty = parent >= 0 && parent == _count - 1;
+
+        if (expect == Expect::End)
+            return false;
+
+        if (expect == Expect::Colon) {
+            if (c != ':')
+                return false;
+            pos++;
+            expect = Expect::Value;
+            continue;
+        }
+
+        // Close the innermost container, either after its last value or straight away if it's empty
+        bool closeObject = c == '}' && parent >= 0 && _tokens[parent].type == JsonType::Object && (expect == Expect::Comma || (expect == Expect::Key && empty));
+        bool closeArray = c == ']' && parent >= 0 && _tokens[parent].type == JsonType::Array && (expect == Expect::Comma || (expect == Expect::Value && empty));
+        if (closeObject || closeArray) {
+            _tokens[parent].next = _count;
+            depth--;
+            pos++;
+            expect = depth > 0 ? Expect::Comma : Expect::End;
+            continue;
+        }
+
+        if (expect == Expect::Comma) {
+            if (c != ',')
+                return false;
+            pos++;
+            expect = _tokens[parent].type == JsonType::Object ? Expect::Key : Expect::Value;
+            continue;
+        }
+
+        if (expect == Expect::Key) {
+            if (c != '"' || addToken(JsonType::String, pos + 1, parent) < 0 || !parseString(pos, length))
+                return false;
+            _tokens[parent].size++;
+            expect = Expect::Colon;
+            continue;
+        }
+
+        // A value, its parent is the key when in an object
+        int valueParent = parent >= 0 && _tokens[parent].type == JsonType::Object ? _count - 1 : parent;
+        bool valid;
+        switch (c) {
+            case '{':
+            case '[': {
+                int token = addToken(c == '{' ? JsonType::Object : JsonType::Array, pos, valueParent);
+                if (token < 0 || depth >= maxDepth)
+                    return false;
+                open[depth++] = token;
+                pos++;
+                expect = c == '{' ? Expect::Key : Expect::Value;
+                if (parent >= 0 && _tokens[parent].type == JsonType::Array)
+                    _tokens[parent].size++;
+                continue;
+            }
+            case '"':
+                valid = addToken(JsonType::String, pos + 1, valueParent) >= 0 && parseString(pos, length);
+                break;
+            case 't':
+                valid = addToken(JsonType::True, pos, valueParent) >= 0 && parseLiteral(pos, length, "true");
+                break;
+            case 'f':
+                valid = addToken(JsonType::False, pos, valueParent) >= 0 && parseLiteral(pos, length, "false");
+                break;
+            case 'n':
+                valid = addToken(JsonType::Null, pos, valueParent) >= 0 && parseLiteral(pos, length, "null");
+                break;
+            default:
+                valid = addToken(JsonType::Number, pos, valueParent) >= 0 && parseNumber(pos, length);
+                break;
+        }
+
+        if (!valid)
+            return false;
+        if (parent >= 0 && _tokens[parent].type == JsonType::Array)
+            _tokens[parent].size++;
+        expect = depth > 0 ? Expect::Comma : Expect::End;
+    }
+
+    return expect == Expect::End;
+}
+
+int JsonReader::addToken(JsonType type, size_t start, int parent) {
+    if (_count >= maxTokens)
+        return -1;
+
+    JsonToken_t &token = _tokens[_count];
+    token.type = type;
+    token.start = start;
+    token.parent = parent;
+    token.next = _count + 1;
+    token.size = 0;
+    return _count++;
+}
+
+bool JsonReader::parseString(size_t &pos, size_t length) {
+    // Unescaping only ever shrinks a string, so it can be written back over itself
+    size_t out = ++pos;
+    while (pos < length) {
+        char c = _text[pos++];
+        if (c == '"') {
+            _text[out] = 0;
+            return true;
+        }
+
+        if ((uint8_t)c < 0x20)
+            return false;
+
+        if (c != '\\') {
+            _text[out++] = c;
+            continue;
+        }
+
+        if (pos >= length)
+            return false;
+
+        c = _text[pos++];
+        switch (c) {
+            case '"':
+            case '\\':
+            case '/':
+                _text[out++] = c;
+                break;
+            case 'b': _text[out++] = '\b'; break;
+            case 'f': _text[out++] = '\f'; break;
+            case 'n': _text[out++] = '\n'; break;
+            case 'r': _text[out++] = '\r'; break;
+            case 't': _text[out++] = '\t'; break;
+            case 'u': {
+                uint32_t codePoint;
+                if (pos + 4 > length || !parseHex4(&_text[pos], codePoint))
+                    return false;
+                pos += 4;
+
+                // Characters outside the BMP come as a surrogate pair
+                uint32_t low;
+                if (codePoint >= 0xD800 && codePoint <= 0xDBFF && pos + 6 <= length && _text[pos] == '\\' && _text[pos + 1] == 'u' &&
+                    parseHex4(&_text[pos + 2], low) && low >= 0xDC00 && low <= 0xDFFF) {
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                    pos += 6;
+                }
+
+                out += encodeUtf8(codePoint, &_text[out]);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+
+    // Never closed
+    return false;
+}
+
+bool JsonReader::parseNumber(size_t &pos, size_t length) {
+    // strtod takes more than JSON does, hex and infinity for a start, so only let it see number characters
+    size_t start = pos;
+    while (pos < length && (strchr("0123456789+-.eE", _text[pos]) != NULL && _text[pos] != 0))
+        pos++;
+
+    bool startsWithDigit = _text[start] >= '0' && _text[start] <= '9';
+    bool negative = _text[start] == '-' && start + 1 < pos && _text[start + 1] >= '0' && _text[start + 1] <= '9';
+    if (!startsWithDigit && !negative)
+        return false;
+
+    // The character after the number stops strtod, so it doesn't need terminating
+    char *end;
+    strtod(&_text[start], &end);
+    return end == &_text[pos];
+}
+
+bool JsonReader::parseLiteral(size_t &pos, size_t length, const char *literal) {
+    size_t literalLength = strlen(literal);
+    if (pos + literalLength > length || strncmp(&_text[pos], literal, literalLength) != 0)
+        return false;
+
+    pos += literalLength;
+    return true;
+}
+
+int JsonReader::get(int object, const char *key) {
+    if (!isObject(object))
+        return -1;
+
+    for (int keyToken = getFirst(object); keyToken >= 0; keyToken = getNext(keyToken)) {
+        if (strcmp(&_text[_tokens[keyToken].start], key) == 0)
+            return keyToken + 1;
+    }
+    return -1;
+}
+
+int JsonReader::getFirst(int token) {
+    if (getSize(token) <= 0)
+        return -1;
+    return token + 1;
+}
+
+int JsonReader::getNext(int token) {
+    if (token < 0 || token >= _count)
+        return -1;
+
+    // Object members are stepped through by key, so skip over the key's value too
+    int parent = _tokens[token].parent;
+    int next = token + 1;
+    if (parent >= 0 && _tokens[parent].type == JsonType::Object)
+        next = _tokens[next].next;
+    else
+        next = _tokens[token].next;
+
+    return parent >= 0 && next < _tokens[parent].next ? next : -1;
+}
+
+int JsonReader::getSize(int token) {
+    if (!isObject(token) && !isArray(token))
+        return 0;
+    return _tokens[token].size;
+}
+
+const char *JsonReader::getString(int token, const char *defaultValue) {
+    if (!isString(token))
+        return defaultValue;
+    return &_text[_tokens[token].start];
+}
+
+double JsonReader::getNumber(int token, double defaultValue) {
+    if (!isNumber(token))
+        return defaultValue;
+    return strtod(&_text[_tokens[token].start], NULL);
+}
+
+int JsonReader::getInt(int token, int defaultValue) {
+    if (!isNumber(token))
+        return defaultValue;
+
+    // Clamp like cJSON's valueint
+    double value = getNumber(token);
+    if (value >= INT32_MAX)
+        return INT32_MAX;
+    if (value <= INT32_MIN)
+        return INT32_MIN;
+    return (int)value;
+}
+
+bool JsonReader::getBool(int token, bool defaultValue) {
+    if (isType(token, JsonType::True))
+        return true;
+    if (isType(token, JsonType::False))
+        return false;
+    return defaultValue;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum class JsonType : uint8_t {
+    Object,
+    Array,
+    String,
+    Number,
+    True,
+    False,
+    Null
+};
+
+typedef struct {
+    JsonType type;
+    uint16_t start;     // Offset into the text, strings start after the opening quote
+    int16_t parent;     // -1 for the root
+    int16_t next;       // Token after this one and everything inside it
+    int16_t size;       // Keys in an object, items in an array
+} JsonToken_t;
+
+// Parses a JSON document where it lies, without allocating
+// Tokens point into the text, and strings are unescaped and null terminated in place, so the text is modified
+// Token indexes are used as handles, -1 meaning missing, and every getter is safe to call with -1
+class JsonReader {
+    public:
+        // Parse length characters of text, which must be null terminated, returns false if it isn't valid JSON or has too many tokens
+        bool parse(char *text, size_t length);
+
+        // Get the value for key in the root object, or in object, -1 if there's no such key
+        int get(const char *key) { return get(0, key); }
+        int get(int object, const char *key);
+
+        // Step through the items of an array, or the keys of an object, -1 when there are no more
+        int getFirst(int token);
+        int getNext(int token);
+        int getSize(int token);
+
+        bool isType(int token, JsonType type) { return token >= 0 && token < _count && _tokens[token].type == type; }
+        bool isString(int token) { return isType(token, JsonType::String); }
+        bool isNumber(int token) { return isType(token, JsonType::Number); }
+        bool isArray(int token) { return isType(token, JsonType::Array); }
+        bool isObject(int token) { return isType(token, JsonType::Object); }
+
+        const char *getString(int token, const char *defaultValue = nullptr);
+        double getNumber(int token, double defaultValue = 0);
+        int getInt(int token, int defaultValue = 0);
+        bool getBool(int token, bool defaultValue = false);
+
+    private:
+        static const int maxTokens = 256;
+        static const int maxDepth = 16;
+
+        // Add a token starting at start, returns its index or -1 if there's no room
+        int addToken(JsonType type, size_t start, int parent);
+
+        // Unescape the string starting at the opening quote in place, pos is left after the closing quote
+        bool parseString(size_t &pos, size_t length);
+        bool parseNumber(size_t &pos, size_t length);
+        bool parseLiteral(size_t &pos, size_t length, const char *literal);
+
+        char *_text = nullptr;
+        JsonToken_t _tokens[maxTokens];
+        int _count = 0;
+};
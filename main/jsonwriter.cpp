@@ -0,0 +1,151 @@
+#include "jsonwriter.hpp"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+JsonWriter::JsonWriter(char *buffer, size_t size, FlushFn flush, void *context)
+: _buffer(buffer), _size(size), _flush(flush), _context(context) {
+    _buffer[0] = 0;
+}
+
+void JsonWriter::beginObject(const char *key) {
+    writeKey(key);
+    write('{');
+    if (++_depth >= maxDepth)
+        _ok = false;
+    _hasValue &= ~(1u << (_depth % maxDepth));
+}
+
+void JsonWriter::endObject() {
+    write('}');
+    if (_depth > 0)
+        _depth--;
+}
+
+void JsonWriter::beginArray(const char *key) {
+    writeKey(key);
+    write('[');
+    if (++_depth >= maxDepth)
+        _ok = false;
+    _hasValue &= ~(1u << (_depth % maxDepth));
+}
+
+void JsonWriter::endArray() {
+    write(']');
+    if (_depth > 0)
+        _depth--;
+}
+
+void JsonWriter::addString(const char *key, const char *value) {
+    if (value == nullptr) {
+        addNull(key);
+        return;
+    }
+
+    writeKey(key);
+    write('"');
+    writeEscaped(value);
+    write('"');
+}
+
+void JsonWriter::addNumber(const char *key, double value) {
+    if (isnan(value) || isinf(value)) {
+        addNull(key);
+        return;
+    }
+
+    // Only integers up to 2^53 are exact in a double
+    if (value == floor(value) && fabs(value) < 9007199254740992.0) {
+        addInt(key, (int64_t)value);
+        return;
+    }
+
+    writeKey(key);
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%.15g", value);
+    write(text, length);
+}
+
+void JsonWriter::addInt(const char *key, int64_t value) {
+    writeKey(key);
+    char text[24];
+    int length = snprintf(text, sizeof(text), "%lld", (long long)value);
+    write(text, length);
+}
+
+void JsonWriter::addBool(const char *key, bool value) {
+    writeKey(key);
+    if (value)
+        write("true", 4);
+    else
+        write("false", 5);
+}
+
+void JsonWriter::addNull(const char *key) {
+    writeKey(key);
+    write("null", 4);
+}
+
+void JsonWriter::writeKey(const char *key) {
+    uint32_t bit = 1u << (_depth % maxDepth);
+    if (_hasValue & bit)
+        write(',');
+    _hasValue |= bit;
+
+    if (key == nullptr)
+        return;
+
+    write('"');
+    writeEscaped(key);
+    write("\":", 2);
+}
+
+void JsonWriter::write(const char *text, size_t length) {
+    while (length > 0) {
+        // Keep a byte for the terminator
+        size_t space = _size - 1 - _length;
+        if (space == 0) {
+            if (_flush == nullptr || !_flush(_context, _buffer, _length)) {
+                _ok = false;
+                return;
+            }
+            _flushed = true;
+            _length = 0;
+            continue;
+        }
+
+        size_t count = length < space ? length : space;
+        memcpy(&_buffer[_length], text, count);
+        _length += count;
+        _buffer[_length] = 0;
+        text += count;
+        length -= count;
+    }
+}
+
+void JsonWriter::writeEscaped(const char *text) {
+    // Write runs of plain characters in one go, UTF-8 passes straight through
+    const char *run = text;
+    for (const char *c = text; *c != 0; c++) {
+        uint8_t ch = (uint8_t)*c;
+        if (ch >= 0x20 && ch != '"' && ch != '\\')
+            continue;
+
+        write(run, c - run);
+        run = c + 1;
+
+        switch (ch) {
+            case '"': write("\\\"", 2); break;
+            case '\\': write("\\\\", 2); break;
+            case '\n': write("\\n", 2); break;
+            case '\r': write("\\r", 2); break;
+            case '\t': write("\\t", 2); break;
+            default: {
+                char escaped[7];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+                write(escaped, 6);
+            }
+        }
+    }
+    write(run, strlen(run));
+}
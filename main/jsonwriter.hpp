@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Writes JSON into a fixed buffer, without allocating
+// With a flush function the buffer is handed over whenever it fills, so output can be any length
+// Without one, anything that doesn't fit is dropped and ok() returns false
+// Keys are only given for members of an object, pass nullptr for array items and the root
+class JsonWriter {
+    public:
+        // Called with the buffered output when the buffer is full, returns false if it couldn't be sent
+        typedef bool (*FlushFn)(void *context, const char *data, size_t length);
+
+        JsonWriter(char *buffer, size_t size, FlushFn flush = nullptr, void *context = nullptr);
+
+        void beginObject(const char *key = nullptr);
+        void endObject();
+        void beginArray(const char *key = nullptr);
+        void endArray();
+
+        void addString(const char *key, const char *value);
+        // Whole numbers are written without a fraction, and NaN or infinity as null
+        void addNumber(const char *key, double value);
+        void addInt(const char *key, int64_t value);
+        void addBool(const char *key, bool value);
+        void addNull(const char *key);
+
+        // Output not yet flushed, null terminated
+        const char *getText() { return _buffer; }
+        size_t getLength() { return _length; }
+
+        // True once part of the output has gone to the flush function
+        bool hasFlushed() { return _flushed; }
+
+        // False if anything was dropped or failed to flush
+        bool ok() { return _ok; }
+
+    private:
+        static const int maxDepth = 32;
+
+        // Write the separator and key before a value
+        void writeKey(const char *key);
+        void write(const char *text, size_t length);
+        void write(char c) { write(&c, 1); }
+        void writeEscaped(const char *text);
+
+        char *_buffer;
+        size_t _size;
+        size_t _length = 0;
+        FlushFn _flush;
+        void *_context;
+        bool _flushed = false;
+        bool _ok = true;
+
+        // Bit per nesting level, set once the level has a value so the next needs a comma
+        uint32_t _hasValue = 0;
+        int _depth = 0;
+};
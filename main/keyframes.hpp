@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary keyframe streams for animations, see POST /api/animation
+// Header only and free of ESP-IDF, so host tools can include it too
+//
+// All values are little endian, a stream is a header then any number of keyframes
+// Header
+//   0   2  Magic, "SK"
+//   2   1  Version, keyframeVersion
+//   3   1  Units in each keyframe, starting from the first unit, any others are left where they are
+// Keyframe
+//   0   2  Hold in milliseconds, once every unit has landed, before the next keyframe starts
+//   2   ...  For each unit
+//        2  Step position to move to, counted from home, keyframeKeep to leave it where it is
+//        1  Step interval, one step every this many step delays, 0 for the unit's calibrated speed
+//           Intervals below the calibrated one are raised to it, so a unit is never driven faster than it was set up for
+//
+// Units only move forward, so a position behind a unit's current one takes it round past home
+
+static const uint8_t keyframeVersion = 1;
+static const size_t keyframeHeaderLength = 4;
+static const size_t keyframeUnitLength = 3;
+static const size_t keyframeMaxLength = 2 + (255 * keyframeUnitLength);
+static const uint16_t keyframeKeep = 0xffff;
+
+// Length of each keyframe in a stream with unitsCount units
+inline size_t getKeyframeLength(uint8_t unitsCount) {
+    return 2 + (unitsCount * keyframeUnitLength);
+}
+
+// Read a stream header, returns false if it isn't a version this build knows
+inline bool decodeKeyframeHeader(const uint8_t *data, uint8_t &unitsCount) {
+    if (data[0] != 'S' || data[1] != 'K' || data[2] != keyframeVersion || data[3] == 0)
+        return false;
+
+    unitsCount = data[3];
+    return true;
+}
+
+// Read a keyframe of getKeyframeLength(unitsCount) bytes, filling targets and intervals for up to maxUnits units
+// Units beyond unitsCount are left where they are
+inline void decodeKeyframe(const uint8_t *data, uint8_t unitsCount, uint16_t &holdMs, uint16_t *targets, uint8_t *intervals,
+    size_t maxUnits) {
+    holdMs = data[0] | (data[1] << 8);
+    for (size_t i = 0; i < maxUnits; i++) {
+        if (i >= unitsCount) {
+            targets[i] = keyframeKeep;
+            intervals[i] = 0;
+            continue;
+        }
+
+        const uint8_t *unit = &data[2 + (i * keyframeUnitLength)];
+        targets[i] = unit[0] | (unit[1] << 8);
+        intervals[i] = unit[2];
+    }
+}
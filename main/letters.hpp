@@ -1,21 +1,38 @@
 #pragma once
 
-// Each letter / flap, in order for a unit
-// Newer C++ should support UTF8 characters here
-const char unitLetters[] = {' ', 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', '$', '&', '#', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', ':', '.', '-', '?', '!'};
+// Each letter / flap, in order for a unit, as unicode code points
+// Common letters can be repeated, units go to whichever copy is nearest
+// Messages can only use letters in this set, so any other flap set can't have letters that aren't here
+constexpr char32_t unitLetters[] = {U' ', U'A', U'B', U'C', U'D', U'E', U'F', U'G', U'H', U'I', U'J', U'K', U'L', U'M', U'N', U'O', U'P', U'Q', U'R', U'S', U'T', U'U', U'V', U'W', U'X', U'Y', U'Z', U'Ä', U'Ö', U'Ü', U'0', U'1', U'2', U'3', U'4', U'5', U'6', U'7', U'8', U'9', U':', U'.', U'-', U'?', U'!'};
 
 // Number of flaps
 const int unitLettersCount = sizeof(unitLetters) / sizeof(unitLetters[0]);
 
-// Index of 'A' within the unitLetters array
-const int unitLettersLettersStart = 1;
-
-// Index if '0' within the unitLetters array
-const int unitLettersNumbersStart = 30;
-
 // Letter numbers to use for calibration
 // Space, Z, A, U, N, ?, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9
 const int calLetters[] = {0, 26, 1, 21, 14, 43, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39};
 
 // Number of letters in calLetters
-const int calLettersCount = sizeof(calLetters) / sizeof(calLetters[0]);
\ No newline at end of file
+const int calLettersCount = sizeof(calLetters) / sizeof(calLetters[0]);
+
+// Digit only drums, e.g. for the clock positions
+constexpr char32_t digitLetters[] = {U' ', U'0', U'1', U'2', U'3', U'4', U'5', U'6', U'7', U'8', U'9', U':'};
+
+// Letter numbers to use for calibrating digit only drums
+const int digitCalLetters[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+typedef struct {
+    const char32_t *letters;
+    int lettersCount;
+    const int *calLetters;
+    int calLettersCount;
+} FlapSet_t;
+
+// Flap sets that can be fitted to a unit, selected per unit in menuconfig
+constexpr FlapSet_t flapSets[] = {
+    { unitLetters, unitLettersCount, calLetters, calLettersCount },
+    { digitLetters, sizeof(digitLetters) / sizeof(digitLetters[0]), digitCalLetters, sizeof(digitCalLetters) / sizeof(digitCalLetters[0]) }
+};
+
+// Number of flap sets
+const int flapSetsCount = sizeof(flapSets) / sizeof(flapSets[0]);
\ No newline at end of file
@@ -0,0 +1,46 @@
+#include "letterstats.hpp"
+#include <string.h>
+
+// Once a unit has this many recorded requests, all counts are halved
+static const uint32_t decayTotal = 256;
+
+LetterStats::LetterStats() {
+    memset(_counts, 0, sizeof(_counts));
+    memset(_totals, 0, sizeof(_totals));
+    memset(_transitions, 0, sizeof(_transitions));
+}
+
+void LetterStats::record(uint8_t unitNum, int letterNum) {
+    if (letterNum < 0 || letterNum >= maxLettersCount)
+        return;
+
+    ++_counts[unitNum][letterNum];
+    ++_totals[unitNum];
+
+    if (_totals[unitNum] < decayTotal)
+        return;
+
+    // Halve everything, so recent requests count for more than old ones
+    _totals[unitNum] = 0;
+    for (int i = 0; i < maxLettersCount; i++) {
+        _counts[unitNum][i] /= 2;
+        _totals[unitNum] += _counts[unitNum][i];
+    }
+}
+
+void LetterStats::recordTransition(int fromLetterNum, int toLetterNum) {
+    if (fromLetterNum < 0 || fromLetterNum >= unitLettersCount || toLetterNum < 0 || toLetterNum >= unitLettersCount)
+        return;
+
+    if (_transitions[fromLetterNum][toLetterNum] < UINT16_MAX) {
+        ++_transitions[fromLetterNum][toLetterNum];
+        return;
+    }
+
+    // Saturated, halve everything so the proportions are kept
+    for (int from = 0; from < unitLettersCount; from++) {
+        for (int to = 0; to < unitLettersCount; to++)
+            _transitions[from][to] /= 2;
+    }
+    ++_transitions[fromLetterNum][toLetterNum];
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "config.h"
+#include "letters.hpp"
+#include "glyphs.hpp"
+#include "sdkconfig.h"
+#include <stdint.h>
+
+// Running histogram of the letters each unit has recently been asked to show
+// Older requests decay away, so the histogram follows changes in what is being displayed
+// Also counts letter to letter transitions across all units, for offline flap order optimisation
+class LetterStats {
+    public:
+        LetterStats();
+
+        // Record that a unit was asked to show letterNum
+        void record(uint8_t unitNum, int letterNum);
+
+        // Get the weight of letterNum for a unit, only meaningful relative to getTotal()
+        uint16_t getCount(uint8_t unitNum, int letterNum) { return _counts[unitNum][letterNum]; }
+
+        // Get the sum of all letter weights for a unit, 0 if nothing recorded
+        uint32_t getTotal(uint8_t unitNum) { return _totals[unitNum]; }
+
+        // Record a unit with the full flap set going from showing one letter to another, ignored if either letter is unknown
+        void recordTransition(int fromLetterNum, int toLetterNum);
+
+        // Get how many times any unit has gone from one letter to another
+        uint16_t getTransitions(int fromLetterNum, int toLetterNum) { return _transitions[fromLetterNum][toLetterNum]; }
+
+    private:
+        uint16_t _counts[CONFIG_UNITS_COUNT][maxLettersCount];
+        uint32_t _totals[CONFIG_UNITS_COUNT];
+        uint16_t _transitions[unitLettersCount][unitLettersCount];
+};
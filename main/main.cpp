@@ -14,7 +14,10 @@
 #include "clock.hpp"
 #include "displaymanager.hpp"
 #include "webserver.hpp"
+#include "udpingest.hpp"
+#include "flapmqtt.hpp"
 #include "config.h"
+#include "boot.h"
 
 static const char *TAG = "Main";
 
@@ -40,6 +43,12 @@ MultiStepper units(steppers, CONFIG_UNITS_COUNT, PIN_EN, PIN_LATCH, PIN_DATA, PI
 Display display(units);
 DisplayManager displayManager(display);
 WebServer webServer(displayManager);
+#ifdef CONFIG_UDP_INGEST
+UdpIngest udpIngest(displayManager);
+#endif
+#ifdef CONFIG_MQTT
+FlapMqtt flapMqtt(displayManager);
+#endif
 
 // Initialise all important shared ESP32 services
 static void initServices();
@@ -47,29 +56,37 @@ static void initServices();
 static void setupLed(void);
 
 extern "C" void app_main(void) {
-    // Start up core services
+    // Start up core services, everything else needs NVS
     initServices();
-    initWifi();
+
+    // Homing and loading calibration run on the display worker while WiFi connects
+    // Nothing waits for the display to be ready, messages queue until it is
     display.start();
+    initWifi();
+    initSntp();
 
-    // Wait on WiFi to complete init
-    if (wifiConnected()) {
-        initSntp();
-        initFlapMdns();
-    } else {
-        displayManager.display("WIFI FAIL", 5000);
-        ESP_LOGE(TAG, "Could not connect to WiFi");
-        return;
-    }
+    // The server can listen before there's an IP, so it's up as soon as WiFi is
+    bootStageStart(BOOT_STAGE_WEBSERVER);
+    webServer.start();
+    bootStageDone(BOOT_STAGE_WEBSERVER);
+#ifdef CONFIG_UDP_INGEST
+    udpIngest.start(CONFIG_UDP_INGEST_PORT);
+#endif
+    displayManager.display("INITIALISE", 500);
 
-    // Wait for display to be ready
-    while (!display.ready()) {
-        vTaskDelay(100 / portTICK_PERIOD_MS);
+    // Wait on WiFi to complete init, it keeps trying after an outage so never give up on it
+    if (!wifiConnected()) {
+        displayManager.display("WIFI FAIL", 5000);
+        ESP_LOGE(TAG, "Could not connect to WiFi, still trying");
+        wifiWaitConnected();
     }
 
-    // Finish up with web server start
-    webServer.start();
-    displayManager.display("INITIALISE", 500);
+    bootStageStart(BOOT_STAGE_MDNS);
+    initFlapMdns();
+    bootStageDone(BOOT_STAGE_MDNS);
+#ifdef CONFIG_MQTT
+    flapMqtt.start();
+#endif
 
     // Nominal blink to show init complete
     bool led = true;
@@ -85,12 +102,14 @@ static void initServices() {
     setupLed();
 
     ESP_LOGI(TAG, "Init NVS");
+    bootStageStart(BOOT_STAGE_NVS);
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
       ESP_ERROR_CHECK(nvs_flash_erase());
       ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    bootStageDone(BOOT_STAGE_NVS);
 }
 
 static void setupLed() {
@@ -0,0 +1,209 @@
+#include "messagewaits.hpp"
+#include "esp_log.h"
+#include "jsonwriter.hpp"
+#include <string.h>
+
+static const char *TAG = "WAITS";
+
+MessageWaits::MessageWaits() {
+    memset(_waits, 0, sizeof(_waits));
+    memset(&_current, 0, sizeof(_current));
+    memset(&_last, 0, sizeof(_last));
+}
+
+MessageWaits::~MessageWaits() {
+    stop();
+}
+
+void MessageWaits::start(httpd_handle_t server) {
+    std::lock_guard<std::mutex> lck(_lock);
+    _server = server;
+
+    if (_timer == nullptr) {
+        const esp_timer_create_args_t timerArgs = {
+            .callback = &tickC,
+            .arg = this,
+            .name = "waits_tick"
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timerArgs, &_timer));
+    }
+    esp_timer_start_periodic(_timer, 250 * 1000);
+}
+
+void MessageWaits::stop() {
+    std::lock_guard<std::mutex> lck(_lock);
+    if (_timer != nullptr)
+        esp_timer_stop(_timer);
+
+    // The server closes the sockets itself
+    for (int i = 0; i < maxWaits; i++) {
+        if (_waits[i].request != nullptr)
+            httpd_req_async_handler_complete(_waits[i].request);
+        _waits[i].request = nullptr;
+    }
+    _waitsCount = 0;
+    _server = nullptr;
+}
+
+bool MessageWaits::hasRoom() {
+    std::lock_guard<std::mutex> lck(_lock);
+    return _server != nullptr && _waitsCount < maxWaits;
+}
+
+esp_err_t MessageWaits::add(httpd_req_t *request, uint32_t messageId, const MessageEta_t &eta, int64_t queuedUs, int timeoutMs) {
+    httpd_req_t *asyncRequest = nullptr;
+    esp_err_t err = httpd_req_async_handler_begin(request, &asyncRequest);
+    if (err != ESP_OK)
+        return err;
+
+    std::lock_guard<std::mutex> lck(_lock);
+    Wait_t *wait = nullptr;
+    for (int i = 0; i < maxWaits && wait == nullptr; i++) {
+        if (_waits[i].request == nullptr)
+            wait = &_waits[i];
+    }
+    if (wait == nullptr) {
+        httpd_req_async_handler_complete(asyncRequest);
+        return ESP_FAIL;
+    }
+
+    memset(wait, 0, sizeof(Wait_t));
+    wait->request = asyncRequest;
+    wait->messageId = messageId;
+    wait->eta = eta;
+    wait->queuedUs = queuedUs;
+    wait->timeoutAtUs = esp_timer_get_time() + ((int64_t)timeoutMs * 1000);
+    _waitsCount++;
+
+    // It may have landed between being queued and getting here
+    if (_last.messageId == messageId) {
+        wait->motion = _last;
+        wait->done = true;
+        queueFlush();
+    }
+
+    return ESP_OK;
+}
+
+void MessageWaits::onDisplayEvent(const DisplayEvent_t &event) {
+    int64_t nowUs = esp_timer_get_time();
+    std::lock_guard<std::mutex> lck(_lock);
+
+    switch (event.type) {
+        case DisplayEventType::Message:
+            memset(&_current, 0, sizeof(_current));
+            _current.messageId = event.message->id;
+            _current.takenUs = nowUs;
+            break;
+        case DisplayEventType::MotionStarted:
+            _current.startedUs = nowUs;
+            break;
+        case DisplayEventType::UnitArrived:
+            _current.unitArrivedUs[event.unitNum] = nowUs;
+            break;
+        case DisplayEventType::MotionDone:
+            _current.doneUs = nowUs;
+            _last = _current;
+            finishWaits();
+            break;
+        case DisplayEventType::Mode:
+        case DisplayEventType::Queue:
+        case DisplayEventType::AnimationStarted:
+        case DisplayEventType::AnimationDone:
+            break;
+    }
+}
+
+void MessageWaits::finishWaits() {
+    bool done = false;
+    for (int i = 0; i < maxWaits; i++) {
+        Wait_t &wait = _waits[i];
+        if (wait.request == nullptr || wait.done || wait.messageId != _last.messageId)
+            continue;
+
+        wait.motion = _last;
+        wait.done = true;
+        done = true;
+    }
+
+    if (done)
+        queueFlush();
+}
+
+void MessageWaits::queueFlush() {
+    if (_server == nullptr || _flushQueued.exchange(true))
+        return;
+
+    if (httpd_queue_work(_server, flushC, this) != ESP_OK)
+        _flushQueued = false;
+}
+
+void MessageWaits::flush() {
+    _flushQueued = false;
+
+    int64_t nowUs = esp_timer_get_time();
+    for (int i = 0; i < maxWaits; i++) {
+        // Taken out under the lock, but sent without it so the display is never held up by a client
+        Wait_t wait;
+        {
+            std::lock_guard<std::mutex> lck(_lock);
+            if (_waits[i].request == nullptr || (!_waits[i].done && nowUs < _waits[i].timeoutAtUs))
+                continue;
+
+            wait = _waits[i];
+            _waits[i].request = nullptr;
+            _waitsCount--;
+        }
+
+        respond(wait);
+        httpd_req_async_handler_complete(wait.request);
+    }
+}
+
+void MessageWaits::respond(const Wait_t &wait) {
+    // Timings are in milliseconds, waits from being queued until taken off the queue, then the motion
+    // Units that didn't move have no arrival
+    const Motion_t &motion = wait.motion;
+    JsonWriter json(_response, sizeof(_response));
+    json.beginObject();
+    json.addString("message", wait.done ? "OK" : "Timed out waiting for the message to land");
+    json.addBool("done", wait.done);
+    json.addInt("startMs", wait.eta.startUs / 1000);
+    json.addInt("arrivalMs", wait.eta.arrivalUs / 1000);
+    if (wait.done) {
+        json.addInt("queueWaitMs", motion.takenUs > wait.queuedUs ? (motion.takenUs - wait.queuedUs) / 1000 : 0);
+        json.addInt("motionMs", (motion.doneUs - motion.startedUs) / 1000);
+        json.beginArray("unitArrivalMs");
+        for (int i = 0; i < CONFIG_UNITS_COUNT; i++) {
+            if (motion.unitArrivedUs[i] > 0)
+                json.addInt(nullptr, (motion.unitArrivedUs[i] - motion.startedUs) / 1000);
+            else
+                json.addNull(nullptr);
+        }
+        json.endArray();
+    }
+    json.endObject();
+
+    if (!json.ok()) {
+        httpd_resp_send_err(wait.request, HTTPD_500_INTERNAL_SERVER_ERROR, "Response too long");
+        return;
+    }
+
+    // Most likely still queued, the client can look for it in GET /api/queue or the event stream
+    if (!wait.done)
+        httpd_resp_set_status(wait.request, "202 Accepted");
+    httpd_resp_set_type(wait.request, "application/json");
+    if (httpd_resp_send(wait.request, json.getText(), json.getLength()) != ESP_OK)
+        ESP_LOGW(TAG, "Could not send response for message %lu", (unsigned long)wait.messageId);
+}
+
+void MessageWaits::tick() {
+    int64_t nowUs = esp_timer_get_time();
+    std::lock_guard<std::mutex> lck(_lock);
+    for (int i = 0; i < maxWaits; i++) {
+        if (_waits[i].request != nullptr && !_waits[i].done && nowUs >= _waits[i].timeoutAtUs) {
+            queueFlush();
+            return;
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "esp_http_server.h"
+#include "esp_timer.h"
+#include "displaymanager.hpp"
+#include <atomic>
+#include <mutex>
+
+// Holds the responses of message requests that asked to wait, until their message has landed or they time out
+// Requests are handed off with httpd_req_async_handler_begin, so the server carries on with others meanwhile
+// Responses are sent from the server task once the display says the message is done
+class MessageWaits {
+    public:
+        static const int defaultTimeoutMs = 30 * 1000;
+        static const int maxTimeoutMs = 120 * 1000;
+
+        MessageWaits();
+        ~MessageWaits();
+
+        void start(httpd_handle_t server);
+        void stop();
+
+        // Whether another request can wait, the server handles one request at a time so this holds for the next add
+        bool hasRoom();
+        // Take over a request until message messageId lands, queuedUs is when it was queued (esp_timer_get_time)
+        esp_err_t add(httpd_req_t *request, uint32_t messageId, const MessageEta_t &eta, int64_t queuedUs, int timeoutMs);
+
+        static void onDisplayEventC(void *context, const DisplayEvent_t &event) { ((MessageWaits*)context)->onDisplayEvent(event); }
+
+        // Each waiting request keeps its socket, so this counts against the server's open sockets
+        static const int maxWaits = 4;
+
+    private:
+
+        // Timings of one message, all esp_timer_get_time, 0 until it happens
+        typedef struct {
+            uint32_t messageId;
+            int64_t takenUs;
+            int64_t startedUs;
+            int64_t doneUs;
+            int64_t unitArrivedUs[CONFIG_UNITS_COUNT];
+        } Motion_t;
+
+        typedef struct {
+            // The copy made by httpd_req_async_handler_begin, nullptr if the slot is free
+            httpd_req_t *request;
+            uint32_t messageId;
+            MessageEta_t eta;
+            int64_t queuedUs;
+            int64_t timeoutAtUs;
+            bool done;
+            Motion_t motion;
+        } Wait_t;
+
+        void onDisplayEvent(const DisplayEvent_t &event);
+
+        // Mark any waits for the last motion done, must hold _lock
+        void finishWaits();
+
+        // Get the server task to send responses for waits that are done or timed out
+        void queueFlush();
+        static void flushC(void *context) { ((MessageWaits*)context)->flush(); }
+        void flush();
+        void respond(const Wait_t &wait);
+
+        static void tickC(void *context) { ((MessageWaits*)context)->tick(); }
+        void tick();
+
+        httpd_handle_t _server = nullptr;
+        esp_timer_handle_t _timer = nullptr;
+        std::atomic_bool _flushQueued = false;
+
+        // Guards the waits and motions
+        std::mutex _lock;
+        Wait_t _waits[maxWaits];
+        int _waitsCount = 0;
+
+        // Always kept, so a wait added just as its message is taken or lands still gets its timings
+        Motion_t _current;
+        Motion_t _last;
+
+        // Responses are only written on the server task, one at a time
+        char _response[256 + (CONFIG_UNITS_COUNT * 12)];
+};
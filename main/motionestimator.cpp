@@ -0,0 +1,68 @@
+#include "motionestimator.hpp"
+
+MotionEstimator::MotionEstimator(UnitCalibration *calibrations, uint64_t stepDelayUs)
+: _calibrations(calibrations), _stepDelayUs(stepDelayUs) {
+}
+
+void MotionEstimator::reset(const int *positions, const int *letters, const int *rotationSteps, int64_t readyUs) {
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        _positions[i] = positions[i];
+        _letters[i] = letters[i];
+        _rotationSteps[i] = rotationSteps[i];
+    }
+
+    _readyUs = readyUs;
+    _held = false;
+}
+
+MessageEta_t MotionEstimator::project(const DisplayMessage_t &message) {
+    MessageEta_t eta = {};
+
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        UnitCalibration &calibration = _calibrations[i];
+        int letterNum = getMessageLetterNum(calibration, message, i, _letters[i]);
+        if (letterNum == _letters[i])
+            continue;
+
+        // Units get pre-staged within their flap while the previous message is held
+        int from = _positions[i];
+#ifdef CONFIG_UNITS_PRESTAGE
+        if (_held && _letters[i] >= 0) {
+            int stagePosition = calibration.getStagePosition(_letters[i]);
+            if (stagePosition > from)
+                from = stagePosition;
+        }
+#endif
+
+        int target = calibration.getPosition(letterNum);
+        int steps = stepsBetween(from, target, _rotationSteps[i]);
+        int ticks = steps * calibration.getStepInterval();
+        if (ticks > eta.travelSteps)
+            eta.travelSteps = ticks;
+        eta.totalSteps += steps;
+
+        _positions[i] = target;
+        _letters[i] = letterNum;
+    }
+
+    // Every unit steps together, so the slowest move decides the duration
+    int64_t travelUs = stepsToUs(eta.travelSteps);
+    eta.startUs = _readyUs;
+    if (message.showAtUs > 0 && message.showAtUs - travelUs > eta.startUs)
+        eta.startUs = message.showAtUs - travelUs;
+    eta.arrivalUs = eta.startUs + travelUs;
+    eta.releaseUs = eta.arrivalUs + (message.minShowMs > 0 ? message.minShowMs * 1000 : 0);
+
+    _readyUs = eta.releaseUs;
+    _held = message.minShowMs > 0;
+    return eta;
+}
+
+int MotionEstimator::stepsBetween(int from, int to, int rotationSteps) {
+    if (to >= from)
+        return to - from;
+
+    // Drums only go forward, so it's the rest of the rotation and then on to the target
+    int stepsToHome = rotationSteps > from ? rotationSteps - from : 0;
+    return stepsToHome + to;
+}
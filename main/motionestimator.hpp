@@ -0,0 +1,41 @@
+#pragma once
+
+#include "calibrate.hpp"
+#include "config.h"
+#include "displaytypes.hpp"
+#include <stdint.h>
+
+// Letter a unit lands on for a message, the flap named if there is one, or else the nearest flap with its glyph
+inline int getMessageLetterNum(UnitCalibration &calibration, const DisplayMessage_t &message, uint8_t unitNum,
+    int fromLetterNum) {
+    if (message.hasFlaps && message.flaps[unitNum] < calibration.getLettersCount())
+        return message.flaps[unitNum];
+    return calibration.getLetterNumForGlyph(message.glyphs[unitNum], fromLetterNum);
+}
+
+class MotionEstimator {
+    public:
+        MotionEstimator(UnitCalibration *calibrations, uint64_t stepDelayUs);
+
+        // Start a projection with units resting at positions and showing letters (-1 if unknown)
+        // Units can start moving from readyUs
+        void reset(const int *positions, const int *letters, const int *rotationSteps, int64_t readyUs);
+
+        // Project the next message in a sequence, the projection then continues from after its hold
+        MessageEta_t project(const DisplayMessage_t &message);
+
+        // Get the number of steps to move forward from one position to another, going round past home if needed
+        static int stepsBetween(int from, int to, int rotationSteps);
+
+        // Convert a number of steps into a duration with the active step rate
+        int64_t stepsToUs(int steps) { return (int64_t)steps * (int64_t)_stepDelayUs; }
+
+    private:
+        UnitCalibration *_calibrations;
+        uint64_t _stepDelayUs;
+        int _positions[CONFIG_UNITS_COUNT];
+        int _letters[CONFIG_UNITS_COUNT];
+        int _rotationSteps[CONFIG_UNITS_COUNT];
+        int64_t _readyUs = 0;
+        bool _held = false;
+};
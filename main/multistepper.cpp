@@ -58,11 +58,31 @@ int MultiStepper::getUnitPosition(uint8_t unitNumber) {
     return _steppers[unitNumber].getPosition();
 }
 
-void MultiStepper::moveAllUnits() {
+void MultiStepper::setStartDelay(uint8_t unitNumber, int steps) {
+    _steppers[unitNumber].setStartDelay(steps);
+}
+
+int MultiStepper::getStepsToTarget(uint8_t unitNumber) {
+    return _steppers[unitNumber].getStepsToTarget();
+}
+
+void MultiStepper::setStepInterval(uint8_t unitNumber, int ticks) {
+    _steppers[unitNumber].setStepInterval(ticks);
+}
+
+int MultiStepper::getFullRotationSteps(uint8_t unitNumber) {
+    return _steppers[unitNumber].getFullRotationSteps();
+}
+
+uint64_t MultiStepper::getStepDelayUs() {
+    return _stepDelay;
+}
+
+void MultiStepper::moveAllUnits(UnitArrivedFn arrived, void *context) {
     if (!_homed)
         home();
 
-    moveToTarget();
+    moveToTarget(arrived, context);
 }
 
 void MultiStepper::home() {
@@ -82,6 +102,67 @@ void MultiStepper::home() {
     ESP_LOGI(TAG, "All motors homed");
 }
 
+void MultiStepper::measureRotations(int rotations, float *stepsPerRotation) {
+    ESP_LOGI(TAG, "Measuring %d rotations", rotations);
+    moveToMagnet();
+
+    // Far enough that every unit passes home each rotation, targets are reset on each pass so the
+    // stepper doesn't give up after a few rotations
+    const int spinTarget = 10000;
+    std::unique_ptr<int[]> hallPasses(new int[_numSteppers]);
+    std::unique_ptr<int[]> rotationsDone(new int[_numSteppers]);
+    std::unique_ptr<int[]> totalSteps(new int[_numSteppers]);
+    for (uint8_t i = 0; i < _numSteppers; i++) {
+        hallPasses[i] = _steppers[i].getHallPasses();
+        rotationsDone[i] = 0;
+        totalSteps[i] = 0;
+        _steppers[i].setTarget(spinTarget);
+    }
+
+    ESP_ERROR_CHECK(gptimer_start(_timer));
+
+    // A unit that hasn't seen the magnet in this many steps has a problem, e.g. a missing magnet
+    long maxTicks = (long)spinTarget * rotations;
+    uint8_t numMotorsDone = 0;
+    for (long tick = 0; tick < maxTicks && numMotorsDone < _numSteppers; tick++) {
+        rolloutPins();
+
+        for (uint8_t i = 0; i < _numSteppers; i++) {
+            if (rotationsDone[i] >= rotations || _steppers[i].getHallPasses() == hallPasses[i])
+                continue;
+
+            // Passed home, so a full rotation has just been counted
+            hallPasses[i] = _steppers[i].getHallPasses();
+            totalSteps[i] += _steppers[i].getFullRotationSteps();
+            ++rotationsDone[i];
+
+            if (rotationsDone[i] < rotations) {
+                _steppers[i].setTarget(spinTarget);
+            } else {
+                _steppers[i].setTarget(0);
+                ++numMotorsDone;
+            }
+        }
+
+        xSemaphoreTake(_timerData.semaphore, portMAX_DELAY);
+    }
+
+    zeroMotors();
+    ESP_ERROR_CHECK(gptimer_stop(_timer));
+
+    for (uint8_t i = 0; i < _numSteppers; i++) {
+        if (rotationsDone[i] < rotations) {
+            ESP_LOGE(TAG, "Motor %d only passed home %d times", i + 1, rotationsDone[i]);
+            _steppers[i].setTarget(_steppers[i].getPosition());
+        }
+
+        stepsPerRotation[i] = rotationsDone[i] > 0 ? (float)totalSteps[i] / rotationsDone[i] : 0;
+        ESP_LOGI(TAG, "Motor %d takes %.2f steps per rotation", i + 1, stepsPerRotation[i]);
+    }
+
+    _homed = true;
+}
+
 void MultiStepper::moveToMagnet() {
     ESP_ERROR_CHECK(gptimer_start(_timer));
 
@@ -119,14 +200,24 @@ void MultiStepper::moveToMagnet() {
     ESP_ERROR_CHECK(gptimer_stop(_timer));
 }
 
-void MultiStepper::moveToTarget() {
-    ESP_ERROR_CHECK(gptimer_start(_timer));
-
+void MultiStepper::moveToTarget(UnitArrivedFn arrived, void *context) {
     uint8_t numMotorsAtTarget = 0;
     std::unique_ptr<bool[]> motorAtTarget(new bool[_numSteppers]);
 
-    for (uint8_t i = 0; i < _numSteppers; i++)
-        motorAtTarget[i] = false;
+    // Units already there arrive straight away, and if that's all of them the timer and shift chain stay idle
+    for (uint8_t i = 0; i < _numSteppers; i++) {
+        motorAtTarget[i] = _steppers[i].isAtTarget();
+        if (!motorAtTarget[i])
+            continue;
+
+        ++numMotorsAtTarget;
+        if (arrived != nullptr)
+            arrived(context, i);
+    }
+    if (numMotorsAtTarget == _numSteppers)
+        return;
+
+    ESP_ERROR_CHECK(gptimer_start(_timer));
 
     // Step each motor until we hit home
     while (numMotorsAtTarget < _numSteppers) {
@@ -143,6 +234,8 @@ void MultiStepper::moveToTarget() {
                 ESP_LOGI(TAG, "Motor %d is at target position", i + 1);
                 ++numMotorsAtTarget;
                 motorAtTarget[i] = true;
+                if (arrived != nullptr)
+                    arrived(context, i);
             }
         }
 
@@ -11,6 +11,9 @@ typedef struct {
     SemaphoreHandle_t semaphore;
 } stepperTimerData_t;
 
+// Called from the stepping loop as each unit reaches its target, so must be quick
+typedef void (*UnitArrivedFn)(void *context, uint8_t unitNumber);
+
 class MultiStepper {
     public:
         MultiStepper(Stepper *steppers, uint8_t numSteppers, gpio_num_t pinEn, gpio_num_t pinLatch, gpio_num_t pinData, gpio_num_t pinClk, uint64_t stepDelayUs);
@@ -26,12 +29,32 @@ class MultiStepper {
         // Get the position of a specific unit
         int getUnitPosition(uint8_t unitNumber);
 
-        // Move all units to their target position
-        void moveAllUnits();
+        // Hold a specific unit still for a number of steps once the move starts, call after setTargetPosition
+        void setStartDelay(uint8_t unitNumber, int steps);
+
+        // Get the number of steps a specific unit needs to reach its target
+        int getStepsToTarget(uint8_t unitNumber);
+
+        // Limit the speed of a specific unit to one step every ticks step delays
+        void setStepInterval(uint8_t unitNumber, int ticks);
+
+        // Get the number of steps for a full rotation of a specific unit, 0 if not yet measured
+        int getFullRotationSteps(uint8_t unitNumber);
+
+        // Get the delay in microseconds between each step
+        uint64_t getStepDelayUs();
+
+        // Move all units to their target position, calling arrived as each one gets there if provided
+        void moveAllUnits(UnitArrivedFn arrived = nullptr, void *context = nullptr);
 
         // Home all the steppers. If this isn't called first, the steppers will be auto-homed on the first movement.
         void home();
 
+        // Turn every unit over a number of full rotations together, timing the hall passes
+        // Populates stepsPerRotation with the average for each unit, 0 if the unit never passed home
+        // Units finish back at home
+        void measureRotations(int rotations, float *stepsPerRotation);
+
     private:
         // Set the pins for every stepper
         void rolloutPins();
@@ -49,7 +72,7 @@ class MultiStepper {
         void moveToMagnet();
 
         // Step all motors until they're at their target position
-        void moveToTarget();
+        void moveToTarget(UnitArrivedFn arrived = nullptr, void *context = nullptr);
 
         // Turn off all motors
         void zeroMotors();
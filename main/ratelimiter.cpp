@@ -0,0 +1,48 @@
+#include "ratelimiter.hpp"
+
+RateLimiter::RateLimiter(int burst, int perMinute) {
+    _tokenIntervalUs = (60 * 1000 * 1000LL) / (perMinute > 0 ? perMinute : 1);
+    _burstUs = _tokenIntervalUs * burst;
+}
+
+int64_t RateLimiter::take(uint32_t client, int count, int64_t nowUs) {
+    Bucket_t *bucket = getBucket(client, nowUs);
+
+    int64_t fullAtUs = bucket->fullAtUs > nowUs ? bucket->fullAtUs : nowUs;
+    fullAtUs += _tokenIntervalUs * count;
+
+    // Taking more than a burst is allowed from a full bucket, or it could never happen
+    if (bucket->fullAtUs > nowUs && fullAtUs - nowUs > _burstUs) {
+        int64_t waitUs = fullAtUs - nowUs - _burstUs;
+        int64_t fullWaitUs = bucket->fullAtUs - nowUs;
+        return waitUs < fullWaitUs ? waitUs : fullWaitUs;
+    }
+
+    bucket->fullAtUs = fullAtUs;
+    return 0;
+}
+
+void RateLimiter::refund(uint32_t client, int count, int64_t nowUs) {
+    // A bucket that's full again has nothing to give back, and may already be another client's
+    for (int i = 0; i < maxClients; i++) {
+        if (_buckets[i].client == client && _buckets[i].fullAtUs > nowUs) {
+            _buckets[i].fullAtUs -= _tokenIntervalUs * count;
+            return;
+        }
+    }
+}
+
+RateLimiter::Bucket_t *RateLimiter::getBucket(uint32_t client, int64_t nowUs) {
+    // A new client takes the bucket that's been full longest, a full bucket is as good as a fresh one
+    Bucket_t *oldest = &_buckets[0];
+    for (int i = 0; i < maxClients; i++) {
+        if (_buckets[i].client == client && _buckets[i].fullAtUs > nowUs)
+            return &_buckets[i];
+        if (_buckets[i].fullAtUs < oldest->fullAtUs)
+            oldest = &_buckets[i];
+    }
+
+    oldest->client = client;
+    oldest->fullAtUs = 0;
+    return oldest;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// A token bucket for each client, so bursts from one client can't crowd out everyone else
+// Not thread safe, the web server handles one request at a time
+class RateLimiter {
+    public:
+        // Each client can take burst tokens at once, refilling at perMinute
+        RateLimiter(int burst, int perMinute);
+
+        // Take count tokens for a client, returns 0 if it had them, or else how many microseconds until it will
+        // More than burst can be taken at once from a full bucket, leaving it in debt
+        int64_t take(uint32_t client, int count, int64_t nowUs);
+
+        // Give back count tokens taken for something that then didn't happen
+        void refund(uint32_t client, int count, int64_t nowUs);
+
+    private:
+        static const int maxClients = 8;
+
+        // Rather than counting tokens, each bucket keeps when it will be full again
+        // Taking a token pushes that a token's interval later, and it can be at most a burst ahead of now
+        typedef struct {
+            uint32_t client;
+            int64_t fullAtUs;
+        } Bucket_t;
+
+        Bucket_t *getBucket(uint32_t client, int64_t nowUs);
+
+        int64_t _tokenIntervalUs;
+        int64_t _burstUs;
+        Bucket_t _buckets[maxClients] = {};
+};
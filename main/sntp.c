@@ -8,29 +8,32 @@
 #include "esp_log.h"
 #include "esp_check.h"
 #include "config.h"
+#include "boot.h"
 
 static const char* TAG = "SNTP";
 
+// Called by SNTP each time the time is set
+static void timeSynced(struct timeval *tv);
+
 void initSntp() {
     ESP_LOGI(TAG, "Initialising");
+    bootStageStart(BOOT_STAGE_TIME);
+
+    setenv("TZ", CONFIG_TIME_ZONE, 1);
+    tzset();
 
-    setenv("TZ", "EST5EDT,M3.2.0/2,M11.1.0", 1);
     esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG(CONFIG_NTP_SERVER);
     config.start = true;                       // start SNTP service explicitly (after connecting)
     config.server_from_dhcp = true;             // accept NTP offers from DHCP server, if any (need to enable *before* connecting)
     config.renew_servers_after_new_IP = true;   // let esp-netif update configured SNTP server(s) after receiving DHCP lease
     config.index_of_first_server = 1;           // updates from server num 1, leaving server 0 (from DHCP) intact
     config.ip_event_to_renew = IP_EVENT_STA_GOT_IP;
+    config.sync_cb = timeSynced;                // syncs in the background, nothing waits on it
     esp_netif_sntp_init(&config);
+}
 
-    int retry = 0;
-    const int retry_count = 15;
-    while (esp_netif_sntp_sync_wait(2000 / portTICK_PERIOD_MS) == ESP_ERR_TIMEOUT && ++retry < retry_count) {
-        ESP_LOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry, retry_count);
-    }
-
-    setenv("TZ", CONFIG_TIME_ZONE, 1);
-    tzset();
+static void timeSynced(struct timeval *tv) {
+    bootStageDone(BOOT_STAGE_TIME);
 
     char strftime_buf[64];
     time_t now = 0;
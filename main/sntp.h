@@ -4,6 +4,7 @@
 extern "C" {
 #endif
 
+// Start keeping the time in sync, returns straight away and the time is set once a server replies
 void initSntp();
 
 #ifdef __cplusplus
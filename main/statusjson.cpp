@@ -0,0 +1,69 @@
+#include "statusjson.hpp"
+#include "glyphs.hpp"
+
+void writeStatusJson(JsonWriter &json, const DisplayState_t &state, const QueuedMessage_t *timeline, size_t timelineCount) {
+    json.beginObject();
+    json.addString("health", "OK");
+    json.addInt("version", state.version);
+    json.addString("mode", getDisplayModeName(state.mode));
+
+    char text[(CONFIG_UNITS_COUNT * 4) + 1];
+    if (state.hasMessage) {
+        encodeGlyphs(state.message, CONFIG_UNITS_COUNT, text, sizeof(text));
+        json.addString("message", text);
+    } else {
+        json.addNull("message");
+    }
+    json.addBool("moving", state.moving);
+
+    // What the latest message took, and totals since boot, unchanged messages only start their hold again
+    json.beginObject("motion");
+    json.addInt("changedUnits", state.changedUnits);
+    json.addInt("steps", state.steps);
+    json.addInt("messages", state.messagesShown);
+    json.addInt("unchangedMessages", state.messagesUnchanged);
+    json.addInt("totalSteps", state.totalSteps);
+    json.endObject();
+
+    json.beginArray("units");
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        json.beginObject();
+        if (state.unitGlyphs[i] == noGlyph) {
+            json.addNull("letter");
+        } else {
+            encodeGlyphs(&state.unitGlyphs[i], 1, text, sizeof(text));
+            json.addString("letter", text);
+        }
+        json.addInt("position", state.unitPositions[i]);
+        json.endObject();
+    }
+    json.endArray();
+
+    json.addInt("queueLength", state.queueLength);
+    json.beginArray("queue");
+    for (size_t i = 0; i < timelineCount; i++) {
+        const QueuedMessage_t &entry = timeline[i];
+        encodeGlyphs(entry.message.glyphs, CONFIG_UNITS_COUNT, text, sizeof(text));
+        json.beginObject();
+        json.addString("message", text);
+        json.addInt("minDisplayMs", entry.message.minShowMs);
+        json.addInt("startMs", entry.eta.startUs / 1000);
+        json.addInt("arrivalMs", entry.eta.arrivalUs / 1000);
+        json.endObject();
+    }
+    json.endArray();
+    json.endObject();
+}
+
+bool StatusCache::write(const DisplayState_t &state, const QueuedMessage_t *timeline, size_t timelineCount) {
+    JsonWriter json(_text, sizeof(_text));
+    writeStatusJson(json, state, timeline, timelineCount);
+    if (!json.ok()) {
+        _length = 0;
+        return false;
+    }
+
+    _length = json.getLength();
+    _version = state.version;
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "displaytypes.hpp"
+#include "jsonwriter.hpp"
+
+// The GET /api/status document, free of ESP-IDF so host tools can write it too
+
+// Write the status for state, with the queued messages and their timings from Display::getQueueTimeline
+void writeStatusJson(JsonWriter &json, const DisplayState_t &state, const QueuedMessage_t *timeline, size_t timelineCount);
+
+// The status document as last written, so polling only writes it again when the state version changes
+class StatusCache {
+    public:
+        // True if the document kept was written for version
+        bool has(uint32_t version) { return _length > 0 && _version == version; }
+
+        // Write and keep the document for state, returns false if it's too big to keep
+        bool write(const DisplayState_t &state, const QueuedMessage_t *timeline, size_t timelineCount);
+
+        const char *getText() { return _text; }
+        size_t getLength() { return _length; }
+
+    private:
+        char _text[1024 * 3];
+        size_t _length = 0;
+        uint32_t _version = 0;
+};
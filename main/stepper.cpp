@@ -36,6 +36,38 @@ void Stepper::setTarget(int stepNum) {
     // Set the target position
     _targetPosition = stepNum;
     _hallRepeatCount = 0;
+    _startDelay = 0;
+    _ticksSinceStep = 0;
+}
+
+void Stepper::setStartDelay(int steps) {
+    _startDelay = steps;
+}
+
+int Stepper::getStepsToTarget() {
+    if (_targetPosition >= _currentPosition)
+        return _targetPosition - _currentPosition;
+
+    // Target is behind us, so we have to go round past home first
+    // Without a measured rotation, the best guess is the target itself
+    int stepsToHome = _fullRotationSteps > _currentPosition ? _fullRotationSteps - _currentPosition : 0;
+    return stepsToHome + _targetPosition;
+}
+
+void Stepper::setStepInterval(int ticks) {
+    _stepInterval = ticks > 1 ? ticks : 1;
+}
+
+int Stepper::getStepInterval() {
+    return _stepInterval;
+}
+
+int Stepper::getFullRotationSteps() {
+    return _fullRotationSteps;
+}
+
+int Stepper::getHallPasses() {
+    return _hallPasses;
 }
 
 bool Stepper::isHome() {
@@ -61,6 +93,17 @@ StepperPins_t Stepper::step() {
     if (_targetPosition == _currentPosition)
         return empty;
 
+    // Not time to start moving yet, so we arrive at the same time as other steppers
+    if (_startDelay > 0) {
+        --_startDelay;
+        return empty;
+    }
+
+    // Speed limited, so hold the current step until it's time for the next one
+    if (++_ticksSinceStep < _stepInterval)
+        return getPinState(_currentPosition % 4);
+    _ticksSinceStep = 0;
+
     // Move to next step
     ++_currentPosition;
     ++_stepsSinceHall;
@@ -106,6 +149,7 @@ bool Stepper::checkHall() {
     _canCheckHallState = false;
     _fullRotationSteps = _stepsSinceHall;
     _stepsSinceHall = 0;
+    ++_hallPasses;
     ++_hallRepeatCount;
     ESP_LOGI(TAG, "Hall %d is at home", _hallPin);
 
@@ -36,6 +36,24 @@ class Stepper {
         // Return the current position of the stepper
         int getPosition();
 
+        // Hold the stepper still for the given number of steps before it starts moving to its target
+        // Cleared whenever a new target is set, so call this after setTarget()
+        void setStartDelay(int steps);
+
+        // Return the number of steps the stepper still has to take to reach its target
+        int getStepsToTarget();
+
+        // Limit the speed, stepping once every ticks calls to step(), 1 for full speed
+        void setStepInterval(int ticks);
+        int getStepInterval();
+
+        // Return the number of steps for a full rotation, as measured between the last two hall passes
+        // 0 if not yet known
+        int getFullRotationSteps();
+
+        // Return the number of times the stepper has passed home, getFullRotationSteps() is updated on each pass
+        int getHallPasses();
+
     private:
         // Get the high (true) / low (false) values for each pin for the provided position
         StepperPins_t getPinState(int stepNumber);
@@ -53,4 +71,8 @@ class Stepper {
         int _hallRepeatCount = 0;
         int _stepsSinceHall = 0;
         int _fullRotationSteps = 0;
+        int _hallPasses = 0;
+        int _startDelay = 0;
+        int _stepInterval = 1;
+        int _ticksSinceStep = 0;
 };
\ No newline at end of file
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Binary message frames for UDP ingest, see CONFIG_UDP_INGEST
+// Header only and free of ESP-IDF, so host tools can include it too, see tools/udpsend
+//
+// All values are little endian
+//   0   2  Magic, "SF"
+//   2   1  Version, udpFrameVersion
+//   3   1  Payload type, UdpPayload
+//   4   4  Sequence number, frames at or below the last one seen from the same sender are dropped
+//   8   4  Coalescing key, 0 never coalesces, see DisplayMessage_t
+//   12  2  Minimum display time in milliseconds
+//   14  1  Priority, queued ahead of any message with a lower priority
+//   15  1  Flags, UdpFrameFlags
+//   16  1  Payload length
+//   17  ...  Payload
+//
+// Glyph and flap payloads have a byte per unit, starting from the first unit, 255 and missing units are left blank
+
+static const uint8_t udpFrameVersion = 1;
+static const size_t udpFrameHeaderLength = 17;
+static const size_t udpFrameMaxPayloadLength = 255;
+static const size_t udpFrameMaxLength = udpFrameHeaderLength + udpFrameMaxPayloadLength;
+
+enum class UdpPayload : uint8_t {
+    Glyphs = 0,     // Glyph for each unit, see glyphs.hpp
+    Flaps = 1,      // Flap number on each unit's own drum, landed on even if another flap has the same letter
+    Text = 2        // UTF-8 text
+};
+
+enum UdpFrameFlags : uint8_t {
+    // Sender has restarted its sequence numbers, so accept this frame whatever its sequence
+    UDP_FRAME_RESET = 1
+};
+
+typedef struct {
+    UdpPayload payloadType;
+    uint8_t flags;
+    uint32_t sequence;
+    uint32_t coalesceKey;
+    uint16_t minDisplayMs;
+    uint8_t priority;
+    uint8_t payloadLength;
+    const uint8_t *payload;     // Points into the frame it was decoded from
+} UdpFrame_t;
+
+// Write a frame into buffer, which must have room for udpFrameMaxLength, returns its length
+inline size_t encodeUdpFrame(const UdpFrame_t &frame, uint8_t *buffer) {
+    buffer[0] = 'S';
+    buffer[1] = 'F';
+    buffer[2] = udpFrameVersion;
+    buffer[3] = (uint8_t)frame.payloadType;
+    for (int i = 0; i < 4; i++) {
+        buffer[4 + i] = (uint8_t)(frame.sequence >> (i * 8));
+        buffer[8 + i] = (uint8_t)(frame.coalesceKey >> (i * 8));
+    }
+    buffer[12] = (uint8_t)frame.minDisplayMs;
+    buffer[13] = (uint8_t)(frame.minDisplayMs >> 8);
+    buffer[14] = frame.priority;
+    buffer[15] = frame.flags;
+    buffer[16] = frame.payloadLength;
+    memcpy(&buffer[udpFrameHeaderLength], frame.payload, frame.payloadLength);
+    return udpFrameHeaderLength + frame.payloadLength;
+}
+
+// Read a frame, returns false if it isn't a whole frame of a version and payload type this build knows
+inline bool decodeUdpFrame(const uint8_t *data, size_t length, UdpFrame_t &frame) {
+    if (length < udpFrameHeaderLength || data[0] != 'S' || data[1] != 'F' || data[2] != udpFrameVersion)
+        return false;
+    if (data[3] > (uint8_t)UdpPayload::Text || length != udpFrameHeaderLength + data[16])
+        return false;
+
+    frame.payloadType = (UdpPayload)data[3];
+    frame.sequence = 0;
+    frame.coalesceKey = 0;
+    for (int i = 3; i >= 0; i--) {
+        frame.sequence = (frame.sequence << 8) | data[4 + i];
+        frame.coalesceKey = (frame.coalesceKey << 8) | data[8 + i];
+    }
+    frame.minDisplayMs = data[12] | (data[13] << 8);
+    frame.priority = data[14];
+    frame.flags = data[15];
+    frame.payloadLength = data[16];
+    frame.payload = &data[udpFrameHeaderLength];
+    return true;
+}
+
+// Tracks the last sequence number from each recent sender, to drop stale and out of order frames
+// Senders are forgotten after a quiet spell, so one that restarts without the reset flag is only ignored for a while
+class UdpSequenceFilter {
+    public:
+        static const int maxSenders = 8;
+        static const int64_t senderTimeoutUs = 30 * 1000 * 1000;
+
+        // Returns true if the frame is newer than anything seen from the sender, sender being its address and port
+        bool accept(uint64_t sender, uint32_t sequence, bool reset, int64_t nowUs) {
+            Sender_t *slot = nullptr;
+            for (int i = 0; i < maxSenders; i++) {
+                Sender_t &candidate = _senders[i];
+                if (candidate.lastUs != 0 && candidate.sender == sender && nowUs - candidate.lastUs < senderTimeoutUs) {
+                    // Serial number arithmetic, so sequences can wrap
+                    if (!reset && (int32_t)(sequence - candidate.sequence) <= 0)
+                        return false;
+                    slot = &candidate;
+                    break;
+                }
+            }
+
+            // New, or forgotten, sender takes the slot that's been quiet longest
+            if (slot == nullptr) {
+                slot = &_senders[0];
+                for (int i = 1; i < maxSenders; i++) {
+                    if (_senders[i].lastUs < slot->lastUs)
+                        slot = &_senders[i];
+                }
+                slot->sender = sender;
+            }
+
+            slot->sequence = sequence;
+            slot->lastUs = nowUs;
+            return true;
+        }
+
+    private:
+        typedef struct {
+            uint64_t sender;
+            uint32_t sequence;
+            int64_t lastUs;     // 0 for an empty slot
+        } Sender_t;
+
+        Sender_t _senders[maxSenders] = {};
+};
@@ -0,0 +1,162 @@
+#include "udpingest.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <esp_pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+static const char *TAG = "UDP";
+
+// How often the worker wakes to check it's still wanted, and logs its counts if anything came in
+static const int receiveTimeoutMs = 1000;
+static const int64_t statsIntervalUs = 60 * 1000 * 1000;
+
+UdpIngest::UdpIngest(DisplayManager &displayManager)
+    : _displayManager(displayManager) {
+
+}
+
+UdpIngest::~UdpIngest() {
+    stop();
+}
+
+void UdpIngest::start(uint16_t port) {
+    if (_active.load())
+        return;
+
+    _port = port;
+    _active = true;
+
+    auto cfg = esp_pthread_get_default_config();
+    cfg.thread_name = "UdpIngest";
+    cfg.stack_size = 1024 * 4;
+    cfg.prio = 5;
+    esp_pthread_set_cfg(&cfg);
+    _workerThread = std::thread(&UdpIngest::worker, this);
+}
+
+void UdpIngest::stop() {
+    if (!_active.load())
+        return;
+
+    // The worker notices within receiveTimeoutMs
+    _active = false;
+    if (_workerThread.joinable())
+        _workerThread.join();
+}
+
+void UdpIngest::worker() {
+    _socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (_socket < 0) {
+        ESP_LOGE(TAG, "Could not create socket");
+        _active = false;
+        return;
+    }
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(_port);
+    if (bind(_socket, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        ESP_LOGE(TAG, "Could not bind to port %d", _port);
+        close(_socket);
+        _socket = -1;
+        _active = false;
+        return;
+    }
+
+    struct timeval timeout = {};
+    timeout.tv_sec = receiveTimeoutMs / 1000;
+    timeout.tv_usec = (receiveTimeoutMs % 1000) * 1000;
+    setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    ESP_LOGI(TAG, "Listening on port %d", _port);
+
+    uint8_t frame[udpFrameMaxLength + 1];
+    int64_t statsAtUs = esp_timer_get_time() + statsIntervalUs;
+    uint32_t statsReceived = 0;
+    while (_active.load()) {
+        struct sockaddr_in from = {};
+        socklen_t fromLength = sizeof(from);
+        // One byte over the largest frame, so oversized datagrams are caught rather than truncated into valid ones
+        int length = recvfrom(_socket, frame, sizeof(frame), 0, (struct sockaddr *)&from, &fromLength);
+        if (length > 0) {
+            uint64_t sender = ((uint64_t)from.sin_addr.s_addr << 16) | from.sin_port;
+            handleFrame(frame, length, sender);
+        }
+
+        if (esp_timer_get_time() >= statsAtUs) {
+            statsAtUs += statsIntervalUs;
+            if (_received != statsReceived) {
+                statsReceived = _received;
+                ESP_LOGI(TAG, "%lu frames, %lu invalid, %lu stale, %lu rejected",
+                    (unsigned long)_received, (unsigned long)_invalid, (unsigned long)_stale, (unsigned long)_rejected);
+            }
+        }
+    }
+
+    close(_socket);
+    _socket = -1;
+}
+
+bool UdpIngest::handleFrame(const uint8_t *data, size_t length, uint64_t sender) {
+    ++_received;
+
+    UdpFrame_t frame;
+    DisplayMessage_t message = {};
+    if (!decodeUdpFrame(data, length, frame) || !decodePayload(frame, message)) {
+        ++_invalid;
+        return false;
+    }
+
+    // Late frames are already out of date, the next one will be along shortly
+    if (!_sequenceFilter.accept(sender, frame.sequence, frame.flags & UDP_FRAME_RESET, esp_timer_get_time())) {
+        ++_stale;
+        return false;
+    }
+
+    message.minShowMs = frame.minDisplayMs;
+    // Numbered the same as keys given over HTTP, and kept clear of internal ones
+    DisplayManager::makeCoalesceKey(frame.coalesceKey, message.coalesceKey);
+    message.priority = frame.priority;
+    if (!_displayManager.displayGlyphs(message)) {
+        ++_rejected;
+        return false;
+    }
+
+    return true;
+}
+
+bool UdpIngest::decodePayload(const UdpFrame_t &frame, DisplayMessage_t &message) {
+    switch (frame.payloadType) {
+        case UdpPayload::Text: {
+            char text[udpFrameMaxPayloadLength + 1];
+            memcpy(text, frame.payload, frame.payloadLength);
+            text[frame.payloadLength] = 0;
+            decodeGlyphs(text, message.glyphs, CONFIG_UNITS_COUNT);
+            return true;
+        }
+
+        case UdpPayload::Glyphs:
+            for (int i = 0; i < CONFIG_UNITS_COUNT; i++) {
+                uint8_t glyph = i < frame.payloadLength ? frame.payload[i] : noGlyph;
+                message.glyphs[i] = glyph < unitLettersCount ? glyph : blankGlyph;
+            }
+            return true;
+
+        case UdpPayload::Flaps:
+            // Landed on exactly, even where the drum has the same letter on another flap
+            message.hasFlaps = true;
+            for (int i = 0; i < CONFIG_UNITS_COUNT; i++) {
+                const FlapSet_t &flapSet = flapSets[getUnitFlapSet(i)];
+                uint8_t flap = i < frame.payloadLength ? frame.payload[i] : noFlap;
+                message.flaps[i] = flap < flapSet.lettersCount ? flap : noFlap;
+                message.glyphs[i] = flap < flapSet.lettersCount ? getGlyph(flapSet.letters[flap]) : blankGlyph;
+            }
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "displaymanager.hpp"
+#include "udpframe.hpp"
+#include <atomic>
+#include <thread>
+
+// Listens for binary message frames over UDP and queues them straight onto the display, see udpframe.hpp
+// Much cheaper per update than HTTP, for high rate feeds like scoreboards and tickers
+class UdpIngest {
+    public:
+        UdpIngest(DisplayManager &displayManager);
+        ~UdpIngest();
+
+        void start(uint16_t port);
+        void stop();
+
+    private:
+        void worker();
+
+        // Queue a frame's message, returns false if it was dropped
+        bool handleFrame(const uint8_t *data, size_t length, uint64_t sender);
+
+        // Turn a frame's payload into what each unit shows, returns false if it isn't valid
+        bool decodePayload(const UdpFrame_t &frame, DisplayMessage_t &message);
+
+        DisplayManager &_displayManager;
+        UdpSequenceFilter _sequenceFilter;
+
+        std::atomic_bool _active = false;
+        std::thread _workerThread;
+        uint16_t _port = 0;
+        int _socket = -1;
+
+        // Frames received, and the ones dropped as invalid, out of order, or because they couldn't be queued
+        uint32_t _received = 0;
+        uint32_t _invalid = 0;
+        uint32_t _stale = 0;
+        uint32_t _rejected = 0;
+};
@@ -1,9 +1,39 @@
 #include "webserver.hpp"
 #include "esp_check.h"
-#include "cJSON.h"
+#include "jsonwriter.hpp"
+#include "boot.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 
 static const char* TAG = "WEBSERVER";
-static const int bufferSize = 1024 * 8; // 8KB
+
+// Event stream clients, waiting requests and an animation upload all hold their sockets for a long time, so the
+// server has room for every one of them and still this many for ordinary requests like the web UI and status polls
+static const int requestSockets = 3;
+static const int maxOpenSockets = EventStream::maxClients + MessageWaits::maxWaits + 1 + requestSockets;
+
+// The server keeps 3 sockets of its own, and MQTT and UDP ingest take one each
+static_assert(maxOpenSockets + 3 + 2 <= CONFIG_LWIP_MAX_SOCKETS, "Not enough sockets for the web server, raise CONFIG_LWIP_MAX_SOCKETS");
+
+// Names for CalibrationState, in order
+static const char *calibrationStateNames[] = {"uncalibrated", "adjusting", "calibrated"};
+
+// Status line for an error code
+static const char *getStatusLine(httpd_err_code_t errorCode);
+
+// Get a number for the client's address, for rate limiting
+static uint32_t getClientId(httpd_req_t *request);
+
+// Coalescing keys may be a whole number or a name, either is hashed (FNV-1a) down to a number
+// Returns false if it's a number that can't be a key
+static bool getCoalesceKey(JsonReader &json, int token, uint32_t &key);
+
+// Times to land at are in milliseconds since the epoch, 0 if not given
+// Returns false if it's negative or too far ahead, see Display::getShowAtUs
+static bool getShowAtUs(JsonReader &json, int token, int64_t &showAtUs);
 
 typedef struct {
     WebServer *webServer;
@@ -11,7 +41,7 @@ typedef struct {
 } callContext_t;
 
 WebServer::WebServer(DisplayManager &displayManager)
-    : _displayManager(displayManager) {
+    : _displayManager(displayManager), _animation(displayManager) {
 
 }
 
@@ -19,8 +49,16 @@ void WebServer::start() {
     if (_active.load())
         return;
 
+    // ETags from before a restart mustn't match, as versions start again from 0
+    _bootId = esp_random();
+
     // Start up the server
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.max_uri_handlers = 16;
+    config.max_open_sockets = maxOpenSockets;
+    config.global_user_ctx = this;
+    config.global_user_ctx_free_fn = keepContextC;
+    config.close_fn = closeSocketC;
     ESP_ERROR_CHECK(httpd_start(&_server, &config));
 
     // Register methods
@@ -52,6 +90,85 @@ void WebServer::start() {
     };
     httpd_register_uri_handler(_server, &postMessage);
 
+    // POST MESSAGES
+    httpd_uri_t postMessages = {
+        .uri = "/api/messages",
+        .method = HTTP_POST,
+        .handler = postMessagesC,
+        .user_ctx = this
+    };
+    httpd_register_uri_handler(_server, &postMessages);
+
+    // GET QUEUE
+    httpd_uri_t getQueue = {
+        .uri = "/api/queue",
+        .method = HTTP_GET,
+        .handler = getQueueC,
+        .user_ctx = this
+    };
+    httpd_register_uri_handler(_server, &getQueue);
+
+    // GET TRANSITIONS
+    httpd_uri_t getTransitions = {
+        .uri = "/api/stats/transitions",
+        .method = HTTP_GET,
+        .handler = getTransitionsC,
+        .user_ctx = this
+    };
+    httpd_register_uri_handler(_server, &getTransitions);
+
+    // GET CALIBRATION
+    httpd_uri_t getCalibration = {
+        .uri = "/api/calibration",
+        .method = HTTP_GET,
+        .handler = getCalibrationC,
+        .user_ctx = this
+    };
+    httpd_register_uri_handler(_server, &getCalibration);
+
+    // POST CALIBRATION
+    httpd_uri_t postCalibration = {
+        .uri = "/api/calibration",
+        .method = HTTP_POST,
+        .handler = postCalibrationC,
+        .user_ctx = this
+    };
+    httpd_register_uri_handler(_server, &postCalibration);
+
+    // GET BOOT
+    httpd_uri_t getBoot = {
+        .uri = "/api/boot",
+        .method = HTTP_GET,
+        .handler = getBootC,
+        .user_ctx = this
+    };
+    httpd_register_uri_handler(_server, &getBoot);
+
+    // GET EVENTS
+    httpd_uri_t getEvents = {
+        .uri = "/api/events",
+        .method = HTTP_GET,
+        .handler = getEventsC,
+        .user_ctx = this
+    };
+    httpd_register_uri_handler(_server, &getEvents);
+
+    // POST ANIMATION
+    httpd_uri_t postAnimation = {
+        .uri = "/api/animation",
+        .method = HTTP_POST,
+        .handler = postAnimationC,
+        .user_ctx = this
+    };
+    httpd_register_uri_handler(_server, &postAnimation);
+
+    _events.start(_server, _displayManager.getMode());
+    _waits.start(_server);
+    if (!_listening) {
+        _listening = _displayManager.addEventListener(EventStream::onDisplayEventC, &_events) &&
+            _displayManager.addEventListener(MessageWaits::onDisplayEventC, &_waits);
+    }
+
     _active = true;
     ESP_LOGI(TAG, "Webserver UP");
 }
@@ -60,87 +177,169 @@ void WebServer::stop() {
     if (!_active.load())
         return;
 
+    _events.stop();
+    _waits.stop();
     httpd_stop(_server);
+    _active = false;
     ESP_LOGI(TAG, "Webserver DOWN");
 }
 
-std::unique_ptr<char[]> WebServer::getBody(httpd_req_t *request) {
-    int totalLen = request->content_len;
-    if (totalLen > bufferSize - 1) {
-        httpd_resp_send_err(request, HTTPD_500_INTERNAL_SERVER_ERROR, "Content too long");
-        return NULL;
+bool WebServer::readJson(httpd_req_t *request) {
+    size_t totalLen = request->content_len;
+    if (totalLen > maxBodyLength) {
+        httpd_resp_send_err(request, HTTPD_413_CONTENT_TOO_LARGE, "Content too long");
+        return false;
     }
-    
-    std::unique_ptr<char[]> buffer = std::unique_ptr<char[]>(new char[bufferSize]);
-    int currentLen = 0;
-    int received = 0;
+
+    size_t currentLen = 0;
     while (currentLen < totalLen) {
-        received = httpd_req_recv(request, &buffer[currentLen], totalLen);
+        int received = httpd_req_recv(request, &_body[currentLen], totalLen - currentLen);
+        if (received == HTTPD_SOCK_ERR_TIMEOUT)
+            continue;
         if (received <= 0) {
             /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(request, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to post control value");
-            return NULL;
+            httpd_resp_send_err(request, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read request");
+            return false;
         }
         currentLen += received;
     }
-    buffer[totalLen] = '\0';
+    _body[totalLen] = '\0';
 
-    return buffer;
-}
+    if (!_json.parse(_body, totalLen)) {
+        httpd_resp_send_err(request, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return false;
+    }
 
-esp_err_t WebServer::responseOk(httpd_req_t *request) {
-    // Assemble JSON
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "message", "OK");
-    const char *responseJson = cJSON_Print(root);
+    return true;
+}
 
-    // Return response
+JsonWriter WebServer::startJson(httpd_req_t *request) {
     httpd_resp_set_type(request, "application/json");
-    httpd_resp_sendstr(request, responseJson);
-    cJSON_Delete(root);
+    return JsonWriter(_response, sizeof(_response), sendChunk, request);
+}
 
-    return ESP_OK;
+esp_err_t WebServer::sendJson(httpd_req_t *request, JsonWriter &json) {
+    // Small responses go in one, with a length, larger ones have already started going out in chunks
+    if (!json.hasFlushed())
+        return httpd_resp_send(request, json.getText(), json.getLength());
+
+    if (json.ok() && json.getLength() > 0)
+        httpd_resp_send_chunk(request, json.getText(), json.getLength());
+    return httpd_resp_send_chunk(request, NULL, 0);
+}
+
+bool WebServer::sendChunk(void *context, const char *data, size_t length) {
+    return httpd_resp_send_chunk((httpd_req_t*)context, data, length) == ESP_OK;
+}
+
+esp_err_t WebServer::responseOk(httpd_req_t *request) {
+    JsonWriter json = startJson(request);
+    json.beginObject();
+    json.addString("message", "OK");
+    json.endObject();
+    return sendJson(request, json);
 }
 
 esp_err_t WebServer::responseErr(httpd_req_t *request, httpd_err_code_t errorCode, const char* errorMessage) {
-    // Assemble JSON
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "message", errorMessage);
-    const char *responseJson = cJSON_Print(root);
+    return responseErr(request, getStatusLine(errorCode), errorMessage);
+}
 
-    // Return response
-    httpd_resp_set_type(request, "application/json");
-    httpd_resp_send_err(request, HTTPD_400_BAD_REQUEST, responseJson);
-    cJSON_Delete(root);
+esp_err_t WebServer::responseErr(httpd_req_t *request, const char* status, const char* errorMessage) {
+    httpd_resp_set_status(request, status);
+    JsonWriter json = startJson(request);
+    json.beginObject();
+    json.addString("message", errorMessage);
+    json.endObject();
+    sendJson(request, json);
 
     return ESP_FAIL;
 }
 
+bool WebServer::admit(httpd_req_t *request, int count) {
+#if CONFIG_API_RATE_PER_MINUTE > 0
+    int64_t retryAfterUs = _rateLimiter.take(getClientId(request), count, esp_timer_get_time());
+    if (retryAfterUs > 0) {
+        responseTooManyRequests(request, retryAfterUs, "Too many messages, slow down");
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+void WebServer::refund(httpd_req_t *request, int count) {
+#if CONFIG_API_RATE_PER_MINUTE > 0
+    _rateLimiter.refund(getClientId(request), count, esp_timer_get_time());
+#endif
+}
+
+esp_err_t WebServer::responseNotQueued(httpd_req_t *request, size_t count) {
+    if (_displayManager.getMode() != DisplayMode::Text)
+        return responseErr(request, "409 Conflict", "Display is not in text mode");
+
+    // Say when the queue will have drained enough to take them, rather than have clients guess
+    int64_t retryAfterUs = _displayManager.getRoomWaitUs(count);
+    if (retryAfterUs < 0)
+        return responseErr(request, HTTPD_400_BAD_REQUEST, "Too many messages");
+    return responseTooManyRequests(request, retryAfterUs, "Queue is full");
+}
+
+esp_err_t WebServer::responseTooManyRequests(httpd_req_t *request, int64_t retryAfterUs, const char* errorMessage) {
+    // Retry-After is in whole seconds, rounded up so clients aren't turned away again
+    int64_t retryAfterS = (retryAfterUs + 999999) / 1000000;
+    snprintf(_retryAfter, sizeof(_retryAfter), "%d", (int)(retryAfterS > 0 ? retryAfterS : 1));
+    httpd_resp_set_hdr(request, "Retry-After", _retryAfter);
+    return responseErr(request, "429 Too Many Requests", errorMessage);
+}
+
 esp_err_t WebServer::getStatus(httpd_req_t *request) {
     ESP_LOGI(TAG, "Get Status");
 
-    // Assemble JSON object
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "health", "OK");
-    const char *statusJson = cJSON_Print(root);
+    // Monitoring polls this a lot, most of the time nothing has changed
+    // One snapshot, so the ETag, the 304 and the body all go with the same version
+    DisplayState_t state;
+    _displayManager.getState(state);
+    if (checkNotModified(request, state.version))
+        return ESP_OK;
 
-    // Send response
     httpd_resp_set_type(request, "application/json");
-    httpd_resp_sendstr(request, statusJson);
-    cJSON_Delete(root);
+    if (!_status.has(state.version)) {
+        size_t count = _displayManager.getQueueTimeline(_timeline);
+        if (!_status.write(state, _timeline, count)) {
+            // Too big to keep, e.g. a long queue of long messages, so write it out as it goes
+            JsonWriter json = startJson(request);
+            writeStatusJson(json, state, _timeline, count);
+            return sendJson(request, json);
+        }
+    }
 
-    return ESP_OK;
+    return httpd_resp_send(request, _status.getText(), _status.getLength());
+}
+
+bool WebServer::checkNotModified(httpd_req_t *request, uint32_t version) {
+    // Headers are sent from this buffer, so it has to last until the response goes
+    snprintf(_etag, sizeof(_etag), "\"%08lx-%lu\"", (unsigned long)_bootId, (unsigned long)version);
+    httpd_resp_set_hdr(request, "ETag", _etag);
+    httpd_resp_set_hdr(request, "Cache-Control", "no-cache");
+
+    char ifNoneMatch[64];
+    if (httpd_req_get_hdr_value_str(request, "If-None-Match", ifNoneMatch, sizeof(ifNoneMatch)) != ESP_OK)
+        return false;
+    if (strstr(ifNoneMatch, _etag) == NULL)
+        return false;
+
+    httpd_resp_set_status(request, "304 Not Modified");
+    httpd_resp_send(request, NULL, 0);
+    return true;
 }
 
 esp_err_t WebServer::postMode(httpd_req_t *request) {
     ESP_LOGI(TAG, "Setting display mode");
 
-    auto body = getBody(request);
-    if (body == NULL)
+    if (!readJson(request))
         return ESP_FAIL;
 
-    cJSON *root = cJSON_Parse(body.get());
-    const char* mode = cJSON_GetObjectItem(root, "mode")->valuestring;
+    const char* mode = _json.getString(_json.get("mode"), "");
 
     if (strcmp(mode, "TEXT") == 0)
         _displayManager.switchMode(DisplayMode::Text);
@@ -152,25 +351,434 @@ esp_err_t WebServer::postMode(httpd_req_t *request) {
         return responseErr(request, HTTPD_400_BAD_REQUEST, errorMessage);
     }
 
-    cJSON_Delete(root);
     return responseOk(request);
 }
 
 esp_err_t WebServer::postMessage(httpd_req_t *request) {
     ESP_LOGI(TAG, "Display Message");
 
-    auto body = getBody(request);
-    if (body == NULL)
+    if (!readJson(request))
+        return ESP_FAIL;
+
+    const char* message = _json.getString(_json.get("message"));
+    if (message == nullptr)
+        return responseErr(request, HTTPD_400_BAD_REQUEST, "Missing message");
+    int minDisplayMs = _json.getInt(_json.get("minDisplayMs"));
+    uint32_t coalesceKey;
+    if (!getCoalesceKey(_json, _json.get("key"), coalesceKey))
+        return responseErr(request, HTTPD_400_BAD_REQUEST, "Invalid key");
+
+    // Optional time for the message to land, in milliseconds since the epoch
+    int64_t showAtUs;
+    if (!getShowAtUs(_json, _json.get("showAtMs"), showAtUs))
+        return responseErr(request, HTTPD_400_BAD_REQUEST, "Invalid showAtMs, must be within an hour of the display's clock");
+
+    // Optionally hold the response until the message has landed, "wait": true or the most milliseconds to wait
+    int waitToken = _json.get("wait");
+    int waitMs = _json.isNumber(waitToken) ? _json.getInt(waitToken) : (_json.getBool(waitToken) ? MessageWaits::defaultTimeoutMs : 0);
+    if (waitMs > MessageWaits::maxTimeoutMs)
+        waitMs = MessageWaits::maxTimeoutMs;
+    if (waitMs > 0 && !_waits.hasRoom())
+        return responseErr(request, "503 Service Unavailable", "Too many requests waiting");
+
+    if (!admit(request, 1))
         return ESP_FAIL;
 
-    cJSON *root = cJSON_Parse(body.get());
-    const char* message = cJSON_GetObjectItem(root, "message")->valuestring;
-    int minDisplayMs = cJSON_GetObjectItem(root, "minDisplayMs")->valueint;
-    bool success = _displayManager.display(message, minDisplayMs);
-    cJSON_Delete(root);
+    MessageEta_t eta;
+    uint32_t messageId;
+    int64_t queuedUs = esp_timer_get_time();
+    bool success = _displayManager.display(message, minDisplayMs, coalesceKey, showAtUs, &eta, &messageId);
+
+    // Nothing was queued, so it doesn't count against the client's rate
+    if (!success) {
+        refund(request, 1);
+        return responseNotQueued(request, 1);
+    }
+
+    // The server carries on with other requests while this one waits
+    if (waitMs > 0 && _waits.add(request, messageId, eta, queuedUs, waitMs) == ESP_OK)
+        return ESP_OK;
+
+    // Let the client know when to expect the message
+    JsonWriter json = startJson(request);
+    json.beginObject();
+    json.addString("message", "OK");
+    json.addInt("startMs", eta.startUs / 1000);
+    json.addInt("arrivalMs", eta.arrivalUs / 1000);
+    json.endObject();
+    return sendJson(request, json);
+}
+
+esp_err_t WebServer::postMessages(httpd_req_t *request) {
+    ESP_LOGI(TAG, "Display Messages");
+
+    if (!readJson(request))
+        return ESP_FAIL;
+
+    int messages = _json.get("messages");
+    int count = _json.getSize(messages);
+    if (!_json.isArray(messages) || count == 0)
+        return responseErr(request, HTTPD_400_BAD_REQUEST, "Missing messages");
+    if (count > (int)Display::maxQueueLength)
+        return responseErr(request, HTTPD_400_BAD_REQUEST, "Too many messages");
+
+    // Check every item before queueing any, so one bad item doesn't leave half a batch on the display
+    MessageRequest_t requests[Display::maxQueueLength];
+    const char* errors[Display::maxQueueLength];
+    bool valid = true;
+    int i = 0;
+    for (int item = _json.getFirst(messages); item >= 0; item = _json.getNext(item), i++) {
+        errors[i] = nullptr;
+        requests[i].message = _json.getString(_json.get(item, "message"));
+        if (!_json.isObject(item) || requests[i].message == nullptr) {
+            errors[i] = "Missing message";
+            valid = false;
+            continue;
+        }
+        requests[i].minDisplayMs = _json.getInt(_json.get(item, "minDisplayMs"));
+        if (!getCoalesceKey(_json, _json.get(item, "key"), requests[i].coalesceKey)) {
+            errors[i] = "Invalid key";
+            valid = false;
+            continue;
+        }
+        if (!getShowAtUs(_json, _json.get(item, "showAtMs"), requests[i].showAtUs)) {
+            errors[i] = "Invalid showAtMs";
+            valid = false;
+        }
+    }
+
+    if (!valid) {
+        httpd_resp_set_status(request, getStatusLine(HTTPD_400_BAD_REQUEST));
+        JsonWriter json = startJson(request);
+        json.beginObject();
+        json.addString("message", "Invalid messages, none were queued");
+        json.beginArray("results");
+        for (i = 0; i < count; i++) {
+            json.beginObject();
+            if (errors[i] != nullptr)
+                json.addString("error", errors[i]);
+            json.endObject();
+        }
+        json.endArray();
+        json.endObject();
+        sendJson(request, json);
+        return ESP_FAIL;
+    }
+
+    if (!admit(request, count))
+        return ESP_FAIL;
+
+    MessageEta_t etas[Display::maxQueueLength];
+    if (!_displayManager.displayBatch(requests, count, etas)) {
+        refund(request, count);
+        return responseNotQueued(request, count);
+    }
+
+    // Timings for each message, in the order given
+    JsonWriter json = startJson(request);
+    json.beginObject();
+    json.addString("message", "OK");
+    json.beginArray("results");
+    for (i = 0; i < count; i++) {
+        json.beginObject();
+        json.addInt("startMs", etas[i].startUs / 1000);
+        json.addInt("arrivalMs", etas[i].arrivalUs / 1000);
+        json.endObject();
+    }
+    json.endArray();
+    json.endObject();
+    return sendJson(request, json);
+}
+
+esp_err_t WebServer::getEvents(httpd_req_t *request) {
+    ESP_LOGI(TAG, "Get Events");
+
+    // The connection is kept by the event stream, which writes to it directly
+    if (!_events.addClient(request))
+        return responseErr(request, "503 Service Unavailable", "Too many event clients");
+
+    return ESP_OK;
+}
+
+esp_err_t WebServer::postAnimation(httpd_req_t *request) {
+    ESP_LOGI(TAG, "Play Animation");
+
+    if (_displayManager.getMode() != DisplayMode::Text)
+        return responseErr(request, "409 Conflict", "Display is not in text mode");
+    if (_animation.busy() || _displayManager.animating())
+        return responseErr(request, "409 Conflict", "An animation is already playing");
+
+    if (!_animation.readHeader(request))
+        return responseErr(request, HTTPD_400_BAD_REQUEST, "Invalid keyframe stream");
+
+    // The rest of the body is read as the display plays it, the server carries on with other requests meanwhile
+    if (!_animation.start(request))
+        return responseErr(request, "409 Conflict", "Could not start the animation");
+
+    return ESP_OK;
+}
+
+void WebServer::closeSocketC(httpd_handle_t server, int socket) {
+    WebServer *webServer = (WebServer*)httpd_get_global_user_ctx(server);
+    webServer->_events.removeClient(socket);
+
+    // Setting close_fn leaves closing the socket to us
+    close(socket);
+}
+
+esp_err_t WebServer::getQueue(httpd_req_t *request) {
+    ESP_LOGI(TAG, "Get Queue");
+
+    if (checkNotModified(request, _displayManager.getStateVersion()))
+        return ESP_OK;
+
+    size_t count = _displayManager.getQueueTimeline(_timeline);
+
+    JsonWriter json = startJson(request);
+    json.beginObject();
+    json.beginArray("queue");
+    for (size_t i = 0; i < count; i++) {
+        const QueuedMessage_t &entry = _timeline[i];
+        char text[(CONFIG_UNITS_COUNT * 4) + 1];
+        encodeGlyphs(entry.message.glyphs, CONFIG_UNITS_COUNT, text, sizeof(text));
+
+        json.beginObject();
+        json.addString("message", text);
+        json.addInt("minDisplayMs", entry.message.minShowMs);
+        json.addInt("startMs", entry.eta.startUs / 1000);
+        json.addInt("arrivalMs", entry.eta.arrivalUs / 1000);
+        json.addInt("releaseMs", entry.eta.releaseUs / 1000);
+        json.addInt("travelSteps", entry.eta.travelSteps);
+        json.addInt("totalSteps", entry.eta.totalSteps);
+        json.endObject();
+    }
+    json.endArray();
+    json.endObject();
+
+    return sendJson(request, json);
+}
+
+esp_err_t WebServer::getTransitions(httpd_req_t *request) {
+    ESP_LOGI(TAG, "Get Transitions");
+
+    std::unique_ptr<uint16_t[]> transitions = std::unique_ptr<uint16_t[]>(new uint16_t[unitLettersCount * unitLettersCount]);
+    _displayManager.getLetterTransitions(transitions.get());
+
+    // One row per 'from' letter, one column per 'to' letter, both in letters.hpp order
+    httpd_resp_set_type(request, "text/csv");
+    char row[unitLettersCount * 6 + 2];
+    for (int from = 0; from < unitLettersCount; from++) {
+        int rowLen = 0;
+        for (int to = 0; to < unitLettersCount; to++)
+            rowLen += snprintf(&row[rowLen], sizeof(row) - rowLen, to == 0 ? "%u" : ",%u", transitions[(from * unitLettersCount) + to]);
+        rowLen += snprintf(&row[rowLen], sizeof(row) - rowLen, "\n");
+        httpd_resp_send_chunk(request, row, rowLen);
+    }
+
+    return httpd_resp_send_chunk(request, NULL, 0);
+}
+
+esp_err_t WebServer::getCalibration(httpd_req_t *request) {
+    ESP_LOGI(TAG, "Get Calibration");
+
+    JsonWriter json = startJson(request);
+    json.beginObject();
+    json.addBool("complete", _displayManager.calibrationComplete());
+    json.beginArray("units");
+    for (uint8_t i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        CalibrationStatus_t status = _displayManager.getCalibrationStatus(i);
+        const FlapSet_t &flapSet = flapSets[status.calibration.getFlapSet()];
+
+        json.beginObject();
+        json.addInt("unit", i);
+        json.addString("state", calibrationStateNames[(int)status.state]);
+        json.addInt("position", status.position);
+        json.addInt("offset", status.calibration.getFirstLetterPosition());
+        json.addNumber("stepsBetweenFlaps", status.calibration.getStepsBetweenFlaps());
+        json.addInt("edgeMargin", status.calibration.getEdgeMargin());
+        json.addInt("rotationSteps", status.calibration.getRotationSteps());
+        json.addInt("stepInterval", status.calibration.getStepInterval());
+        json.addInt("flapSet", status.calibration.getFlapSet());
+        json.addInt("letters", flapSet.lettersCount);
+
+        // Letters worth checking with 'show' once calibrated
+        json.beginArray("checkLetters");
+        for (int j = 0; j < flapSet.calLettersCount; j++)
+            json.addInt(nullptr, flapSet.calLetters[j]);
+        json.endArray();
+
+        json.endObject();
+    }
+    json.endArray();
+    json.endObject();
+
+    return sendJson(request, json);
+}
+
+esp_err_t WebServer::postCalibration(httpd_req_t *request) {
+    ESP_LOGI(TAG, "Calibrate");
+
+    if (!readJson(request))
+        return ESP_FAIL;
+
+    const char *action = _json.getString(_json.get("action"));
+    if (action == nullptr)
+        return responseErr(request, HTTPD_400_BAD_REQUEST, "Missing action");
+
+    CalibrationCommand_t command = {};
+    command.unitNum = _json.getInt(_json.get("unit"), -1);
+    int unitsCount = 1;
+    bool success = true;
+
+    if (strcmp(action, "measure") == 0) {
+        command.action = CalibrationAction::Measure;
+        success = _displayManager.calibrate(command);
+    } else if (strcmp(action, "jog") == 0) {
+        command.action = CalibrationAction::Jog;
+        command.value = _json.getInt(_json.get("steps"), 1);
+        success = _displayManager.calibrate(command);
+    } else if (strcmp(action, "show") == 0 || strcmp(action, "confirm") == 0) {
+        command.action = strcmp(action, "show") == 0 ? CalibrationAction::ShowLetter : CalibrationAction::Confirm;
+        command.value = _json.getInt(_json.get("letter"), 0);
+        success = _displayManager.calibrate(command);
+    } else if (strcmp(action, "offset") == 0) {
+        // Either one unit, or every unit at once from an array
+        command.action = CalibrationAction::SetOffset;
+        command.stepsBetweenFlaps = (float)_json.getNumber(_json.get("stepsBetweenFlaps"), 0);
+
+        int offsets = _json.get("offsets");
+        if (_json.isArray(offsets)) {
+            // Every unit's offset is checked before any is set, so a bad one changes nothing
+            int count = _json.getSize(offsets);
+            if (count == 0 || count > CONFIG_UNITS_COUNT)
+                return responseErr(request, HTTPD_400_BAD_REQUEST, "Invalid offsets, need one for each unit from the first");
+
+            CalibrationCommand_t commands[CONFIG_UNITS_COUNT];
+            int unitNum = 0;
+            for (int item = _json.getFirst(offsets); item >= 0; item = _json.getNext(item), unitNum++) {
+                commands[unitNum] = command;
+                commands[unitNum].unitNum = unitNum;
+                commands[unitNum].value = _json.isNumber(item) ? _json.getInt(item, -1) : -1;
+            }
+            success = _displayManager.calibrate(commands, count);
+            command.unitNum = 0;
+            unitsCount = count;
+        } else {
+            command.value = _json.getInt(_json.get("offset"), -1);
+            success = _displayManager.calibrate(command);
+        }
+    } else if (strcmp(action, "speed") == 0) {
+        command.action = CalibrationAction::SetStepInterval;
+        command.value = _json.getInt(_json.get("stepInterval"), 0);
+        success = _displayManager.calibrate(command);
+    } else if (strcmp(action, "margin") == 0) {
+        command.action = CalibrationAction::SetEdgeMargin;
+        command.value = _json.getInt(_json.get("edgeMargin"), -1);
+        success = _displayManager.calibrate(command);
+    } else {
+        success = false;
+    }
+
+    if (!success && (command.action == CalibrationAction::Confirm || command.action == CalibrationAction::SetOffset) &&
+        command.stepsBetweenFlaps <= 0) {
+        for (int i = command.unitNum; i >= 0 && i < command.unitNum + unitsCount && i < CONFIG_UNITS_COUNT; i++) {
+            if (_displayManager.getCalibrationStatus(i).calibration.getStepsBetweenFlaps() <= 0)
+                return responseErr(request, HTTPD_400_BAD_REQUEST, "Unit hasn't been measured, run measure first or give stepsBetweenFlaps");
+        }
+    }
 
     if (!success)
-        return responseErr(request, HTTPD_500_INTERNAL_SERVER_ERROR, "Could not display message, check active mode");
+        return responseErr(request, HTTPD_400_BAD_REQUEST, "Invalid calibration command");
 
+    // Commands run between messages, poll GET /api/calibration to follow them
+    httpd_resp_set_status(request, "202 Accepted");
     return responseOk(request);
+}
+
+static bool getCoalesceKey(JsonReader &json, int token, uint32_t &key) {
+    if (json.isNumber(token))
+        return DisplayManager::makeCoalesceKey(json.getNumber(token), key);
+
+    key = json.isString(token) ? DisplayManager::makeCoalesceKey(json.getString(token)) : 0;
+    return true;
+}
+
+static bool getShowAtUs(JsonReader &json, int token, int64_t &showAtUs) {
+    showAtUs = 0;
+    return !json.isNumber(token) || Display::getShowAtUs(json.getNumber(token), showAtUs);
+}
+
+static uint32_t getClientId(httpd_req_t *request) {
+    struct sockaddr_storage address = {};
+    socklen_t addressLength = sizeof(address);
+    if (getpeername(httpd_req_to_sockfd(request), (struct sockaddr *)&address, &addressLength) != 0)
+        return 0;
+
+    // Same FNV-1a as coalescing keys, over the address alone so every connection from a client shares a bucket
+    const uint8_t *bytes;
+    size_t length;
+    if (address.ss_family == AF_INET6) {
+        bytes = (const uint8_t *)&((struct sockaddr_in6 *)&address)->sin6_addr;
+        length = sizeof(struct in6_addr);
+    } else {
+        bytes = (const uint8_t *)&((struct sockaddr_in *)&address)->sin_addr;
+        length = sizeof(struct in_addr);
+    }
+
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+esp_err_t WebServer::getBoot(httpd_req_t *request) {
+    ESP_LOGI(TAG, "Get Boot");
+
+    // Times are milliseconds since boot, stages still running have no doneMs
+    JsonWriter json = startJson(request);
+    json.beginObject();
+    json.beginArray("stages");
+    for (int i = 0; i < BOOT_STAGES_COUNT; i++) {
+        int64_t startUs, doneUs;
+        getBootStage((BootStage_t)i, &startUs, &doneUs);
+
+        json.beginObject();
+        json.addString("stage", getBootStageName((BootStage_t)i));
+        if (startUs > 0)
+            json.addNumber("startMs", (double)startUs / 1000);
+        if (doneUs > 0) {
+            json.addNumber("doneMs", (double)doneUs / 1000);
+            json.addNumber("durationMs", (double)(doneUs - startUs) / 1000);
+        }
+        json.endObject();
+    }
+    json.endArray();
+
+    // The number that matters, how long until the display first shows something
+    int64_t startUs, doneUs;
+    getBootStage(BOOT_STAGE_FIRST_MESSAGE, &startUs, &doneUs);
+    if (doneUs > 0)
+        json.addNumber("firstMessageMs", (double)doneUs / 1000);
+    else
+        json.addNull("firstMessageMs");
+    json.endObject();
+
+    return sendJson(request, json);
+}
+
+static const char *getStatusLine(httpd_err_code_t errorCode) {
+    switch (errorCode) {
+        case HTTPD_400_BAD_REQUEST:
+            return "400 Bad Request";
+        case HTTPD_404_NOT_FOUND:
+            return "404 Not Found";
+        case HTTPD_408_REQ_TIMEOUT:
+            return "408 Request Timeout";
+        case HTTPD_413_CONTENT_TOO_LARGE:
+            return "413 Content Too Large";
+        default:
+            return "500 Internal Server Error";
+    }
 }
\ No newline at end of file
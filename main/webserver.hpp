@@ -4,6 +4,13 @@
 #include <atomic>
 #include <memory>
 #include "displaymanager.hpp"
+#include "jsonreader.hpp"
+#include "jsonwriter.hpp"
+#include "statusjson.hpp"
+#include "eventstream.hpp"
+#include "messagewaits.hpp"
+#include "animationstream.hpp"
+#include "ratelimiter.hpp"
 
 class WebServer {
     public:
@@ -13,9 +20,37 @@ class WebServer {
         void stop();
     private:
         DisplayManager &_displayManager;
-        static std::unique_ptr<char[]> getBody(httpd_req_t *request);
-        static esp_err_t responseOk(httpd_req_t *request);
-        static esp_err_t responseErr(httpd_req_t *request, httpd_err_code_t errorCode, const char* errorMessage);
+
+        // Read the request body into _body and parse it into _json, sending an error response if it can't
+        bool readJson(httpd_req_t *request);
+
+        // Start a JSON response in _response, sent in chunks if it outgrows it
+        JsonWriter startJson(httpd_req_t *request);
+        esp_err_t sendJson(httpd_req_t *request, JsonWriter &json);
+        static bool sendChunk(void *context, const char *data, size_t length);
+
+        // Set the ETag for a state version, and send 304 Not Modified if the client already has it
+        // Returns true if the response has been sent
+        bool checkNotModified(httpd_req_t *request, uint32_t version);
+
+        esp_err_t responseOk(httpd_req_t *request);
+        esp_err_t responseErr(httpd_req_t *request, httpd_err_code_t errorCode, const char* errorMessage);
+        // For statuses httpd_err_code_t doesn't have, status is the full status line e.g. "503 Service Unavailable"
+        esp_err_t responseErr(httpd_req_t *request, const char* status, const char* errorMessage);
+
+        // Take count messages from the client's rate limit, sending 429 Too Many Requests if it's over
+        // Returns false if the response has been sent
+        bool admit(httpd_req_t *request, int count);
+        // Give back what admit took, for messages that weren't queued after all
+        void refund(httpd_req_t *request, int count);
+        // Send why count messages couldn't be queued, 429 with when to try again if the queue is full
+        esp_err_t responseNotQueued(httpd_req_t *request, size_t count);
+        esp_err_t responseTooManyRequests(httpd_req_t *request, int64_t retryAfterUs, const char* errorMessage);
+
+        // Called by the server as it closes each connection, so event clients can be dropped
+        static void closeSocketC(httpd_handle_t server, int socket);
+        // The server would otherwise free its user context, which is this
+        static void keepContextC(void *context) {}
 
         // Methods
 
@@ -31,6 +66,62 @@ class WebServer {
         esp_err_t postMessage(httpd_req_t *request);
         static esp_err_t postMessageC(httpd_req_t *request) { return ((WebServer*)request->user_ctx)->postMessage(request); }
 
+        // Queue several messages at once, all or nothing
+        esp_err_t postMessages(httpd_req_t *request);
+        static esp_err_t postMessagesC(httpd_req_t *request) { return ((WebServer*)request->user_ctx)->postMessages(request); }
+
+        // Predicted timeline of the message queue
+        esp_err_t getQueue(httpd_req_t *request);
+        static esp_err_t getQueueC(httpd_req_t *request) { return ((WebServer*)request->user_ctx)->getQueue(request); }
+
+        // Calibration state of every unit
+        esp_err_t getCalibration(httpd_req_t *request);
+        static esp_err_t getCalibrationC(httpd_req_t *request) { return ((WebServer*)request->user_ctx)->getCalibration(request); }
+
+        // Queue a calibration command
+        esp_err_t postCalibration(httpd_req_t *request);
+        static esp_err_t postCalibrationC(httpd_req_t *request) { return ((WebServer*)request->user_ctx)->postCalibration(request); }
+
+        // Letter transition counts, as CSV for tools/flaporder
+        esp_err_t getTransitions(httpd_req_t *request);
+        static esp_err_t getTransitionsC(httpd_req_t *request) { return ((WebServer*)request->user_ctx)->getTransitions(request); }
+
+        // Stream of display events, as Server-Sent Events
+        esp_err_t getEvents(httpd_req_t *request);
+        static esp_err_t getEventsC(httpd_req_t *request) { return ((WebServer*)request->user_ctx)->getEvents(request); }
+
+        // Play a binary stream of keyframes, see keyframes.hpp
+        esp_err_t postAnimation(httpd_req_t *request);
+        static esp_err_t postAnimationC(httpd_req_t *request) { return ((WebServer*)request->user_ctx)->postAnimation(request); }
+
+        // When each stage of start up ran
+        esp_err_t getBoot(httpd_req_t *request);
+        static esp_err_t getBootC(httpd_req_t *request) { return ((WebServer*)request->user_ctx)->getBoot(request); }
+
         std::atomic_bool _active = false;
         httpd_handle_t _server;
+        EventStream _events;
+        MessageWaits _waits;
+        AnimationStream _animation;
+        bool _listening = false;
+
+        // Requests are handled one at a time on the server task, so they all share one body buffer and parser
+        // and one response buffer
+        static const size_t maxBodyLength = 1024 * 8;
+        char _body[maxBodyLength + 1];
+        JsonReader _json;
+        char _response[1024];
+
+#if CONFIG_API_RATE_PER_MINUTE > 0
+        RateLimiter _rateLimiter = RateLimiter(CONFIG_API_RATE_BURST, CONFIG_API_RATE_PER_MINUTE);
+#endif
+        char _retryAfter[12];
+
+        // Part of every ETag, so they're only good until the server restarts
+        uint32_t _bootId;
+        char _etag[24];
+
+        // Status document, only written again when the state version changes
+        StatusCache _status;
+        QueuedMessage_t _timeline[Display::maxQueueLength];
 };
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
@@ -10,48 +11,178 @@
 #include "lwip/err.h"
 #include "lwip/sys.h"
 
+#include "esp_timer.h"
+#include "nvs.h"
+#include "boot.h"
+
 #define MAX_RETRIES 5
 static const char *TAG = "WIFI";
 
+/* Once the retries have run out, keep trying in the background, doubling the delay each time up to a limit */
+#define RECONNECT_FIRST_MS 500
+#define RECONNECT_MAX_MS   60000
+
 /* The event group allows multiple bits for each event, but we only care about two events:
  * - we are connected to the AP with an IP
- * - we failed to connect after the maximum amount of retries */
+ * - we failed to connect after the maximum amount of retries, reconnecting carries on in the background */
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT      BIT1
 
+/* The AP last connected to, saved so the next boot can go straight to it without scanning */
+typedef struct {
+    uint8_t ssid[32];   /* Ignored if the configured SSID has changed since */
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifiCache_t;
+
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
 
+static esp_netif_t *s_netif;
+static esp_timer_handle_t s_reconnect_timer;
+static wifiCache_t s_cache;
+static bool s_fast_connect = false;
 static int s_retry_num = 0;
+
+static bool loadCache() {
+    nvs_handle_t nvs;
+    if (nvs_open("wifi", NVS_READONLY, &nvs) != ESP_OK)
+        return false;
+
+    size_t length = sizeof(s_cache);
+    esp_err_t err = nvs_get_blob(nvs, "ap", &s_cache, &length);
+    nvs_close(nvs);
+
+    return err == ESP_OK && length == sizeof(s_cache) &&
+        strncmp((const char*)s_cache.ssid, CONFIG_WIFI_SSID, sizeof(s_cache.ssid)) == 0;
+}
+
+static void saveCache(const uint8_t *bssid, uint8_t channel) {
+    // Only write when it changes, to spare the flash
+    if (memcmp(s_cache.bssid, bssid, sizeof(s_cache.bssid)) == 0 && s_cache.channel == channel &&
+        strncmp((const char*)s_cache.ssid, CONFIG_WIFI_SSID, sizeof(s_cache.ssid)) == 0)
+        return;
+
+    memset(&s_cache, 0, sizeof(s_cache));
+    strncpy((char*)s_cache.ssid, CONFIG_WIFI_SSID, sizeof(s_cache.ssid));
+    memcpy(s_cache.bssid, bssid, sizeof(s_cache.bssid));
+    s_cache.channel = channel;
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open("wifi", NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, "ap", &s_cache, sizeof(s_cache));
+        if (err == ESP_OK)
+            err = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "Failed to save AP: %s", esp_err_to_name(err));
+}
+
+/* Forget the saved AP and scan every channel on the next connect */
+static void useFullScan() {
+    wifi_config_t wifi_config;
+    ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &wifi_config));
+    wifi_config.sta.bssid_set = false;
+    wifi_config.sta.channel = 0;
+    wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+}
+
+#ifdef CONFIG_WIFI_STATIC_IP
+static void setStaticIp() {
+    esp_netif_ip_info_t ip_info = { 0 };
+    esp_netif_str_to_ip4(CONFIG_WIFI_STATIC_IP_ADDRESS, &ip_info.ip);
+    esp_netif_str_to_ip4(CONFIG_WIFI_STATIC_NETMASK, &ip_info.netmask);
+    esp_netif_str_to_ip4(CONFIG_WIFI_STATIC_GATEWAY, &ip_info.gw);
+
+    // Before WiFi starts, so the DHCP client never gets going and the address is there as soon as it connects
+    ESP_ERROR_CHECK(esp_netif_dhcpc_stop(s_netif));
+    ESP_ERROR_CHECK(esp_netif_set_ip_info(s_netif, &ip_info));
+
+    esp_netif_dns_info_t dns = { 0 };
+    dns.ip.type = ESP_IPADDR_TYPE_V4;
+    esp_netif_str_to_ip4(CONFIG_WIFI_STATIC_DNS, &dns.ip.u_addr.ip4);
+    ESP_ERROR_CHECK(esp_netif_set_dns_info(s_netif, ESP_NETIF_DNS_MAIN, &dns));
+}
+#endif
+
+static void reconnect(void* arg) {
+    esp_wifi_connect();
+}
+
 static void event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
         esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*) event_data;
+        saveCache(event->bssid, event->channel);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+
+        // The saved AP may have gone or moved channel, so from now on scan for the best one
+        if (s_fast_connect) {
+            ESP_LOGI(TAG, "saved AP unavailable, scanning");
+            s_fast_connect = false;
+            useFullScan();
+            esp_wifi_connect();
+            return;
+        }
+
+        // Drops after a working connection retry the same AP first, it's usually still there
         if (s_retry_num < MAX_RETRIES) {
             esp_wifi_connect();
             s_retry_num++;
             ESP_LOGI(TAG, "retry to connect to the AP");
         } else {
             xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+
+            // It hasn't come back, so reconnect in the background to whichever AP is best
+            if (s_retry_num == MAX_RETRIES)
+                useFullScan();
+
+            int shift = s_retry_num - MAX_RETRIES;
+            int delay_ms = shift < 8 ? RECONNECT_FIRST_MS << shift : RECONNECT_MAX_MS;
+            if (delay_ms > RECONNECT_MAX_MS)
+                delay_ms = RECONNECT_MAX_MS;
+            s_retry_num++;
+
+            ESP_LOGI(TAG, "retry to connect to the AP in %d ms", delay_ms);
+            esp_timer_start_once(s_reconnect_timer, (uint64_t)delay_ms * 1000);
         }
         ESP_LOGI(TAG,"connect to the AP fail");
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "got ip: " IPSTR, IP2STR(&event->ip_info.ip));
+        bootStageDone(BOOT_STAGE_WIFI);
         s_retry_num = 0;
+        // Connected, so a later drop retries the AP rather than giving up on it straight away
+        s_fast_connect = false;
+        xEventGroupClearBits(s_wifi_event_group, WIFI_FAIL_BIT);
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
     }
 }
 
 void initWifi() {
+    bootStageStart(BOOT_STAGE_WIFI);
     s_wifi_event_group = xEventGroupCreate();
 
     ESP_ERROR_CHECK(esp_netif_init());
 
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_create_default_wifi_sta();
+    s_netif = esp_netif_create_default_wifi_sta();
+#ifdef CONFIG_WIFI_STATIC_IP
+    setStaticIp();
+#endif
+
+    const esp_timer_create_args_t reconnect_timer_args = {
+        .callback = &reconnect,
+        .name = "wifi_reconnect"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&reconnect_timer_args, &s_reconnect_timer));
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -81,6 +212,17 @@ void initWifi() {
             //.threshold.authmode = WIFI_AUTH_WPA2_WPA3_PSK
         },
     };
+
+    // Go straight to the AP from last time, on its channel, rather than scanning them all
+    if (loadCache()) {
+        ESP_LOGI(TAG, "connecting to saved AP on channel %d", s_cache.channel);
+        memcpy(wifi_config.sta.bssid, s_cache.bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.bssid_set = true;
+        wifi_config.sta.channel = s_cache.channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+        s_fast_connect = true;
+    }
+
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
     ESP_ERROR_CHECK(esp_wifi_start() );
@@ -111,4 +253,12 @@ bool wifiConnected() {
     }
 
     return false;
+}
+
+void wifiWaitConnected() {
+    xEventGroupWaitBits(s_wifi_event_group,
+            WIFI_CONNECTED_BIT,
+            pdFALSE,
+            pdTRUE,
+            portMAX_DELAY);
 }
\ No newline at end of file
@@ -4,12 +4,16 @@
 extern "C" {
 #endif
 
-// Connect to WiFi
+// Start connecting to WiFi, returns without waiting for the connection
 void initWifi();
 
-// Check if WiFi is connected or not
+// Wait for WiFi to connect, false if the first few attempts all failed
+// Reconnecting carries on in the background either way, including after the connection drops
 bool wifiConnected();
 
+// Wait for however long it takes WiFi to connect
+void wifiWaitConnected();
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
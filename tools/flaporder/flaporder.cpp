@@ -0,0 +1,569 @@
+// Flap order optimiser
+//
+// Drums only rotate forward, so the order of the flaps decides how far a unit travels between letters.
+// This searches for the flap order with the least expected forward travel for real content, and prints
+// it as a ready to use letters.hpp.
+//
+// Usage:
+//   flaporder --letters main/letters.hpp --corpus messages.txt [--units 10] > letters.hpp
+//   flaporder --letters main/letters.hpp --matrix transitions.csv > letters.hpp
+//
+// --corpus   Message history, one message per line in the order they were shown
+// --matrix   Transition counts from the device: curl http://splitflap.local/api/stats/transitions
+//            Rows / columns are in the order of the letters.hpp the device was built with
+// --units    Number of units, messages are padded / truncated to this (default 10)
+// --restarts Number of independent searches (default 8)
+// --iterations Swaps tried per search (default 2000000)
+// --seed     Random seed, for repeatable output (default 1)
+//
+// The report is written to stderr, so stdout can be redirected straight into main/letters.hpp.
+// Everything but the two arrays is copied byte for byte, so the file keeps its line endings, CRLF as checked in.
+// The first flap is kept first, since only the cyclic order matters and calibration expects it there.
+// A letter can be on more than one flap, each copy is placed on its own and units go to whichever copy is nearest.
+// Only unitLetters is reordered, calLetters is updated to match and any other flap sets are left as they are.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+typedef std::vector<std::vector<int64_t>> Matrix;
+
+// The flaps on the drum, a letter on more than one flap is numbered by its first flap, as glyphs are
+struct Flaps {
+    std::vector<uint32_t> letters;          // Letter on each flap, in letters.hpp order
+    std::vector<int> letterNums;            // Letter number of each flap
+    std::vector<std::vector<int>> copies;   // Flaps with each letter number, empty for flaps repeating an earlier one
+};
+
+struct Options {
+    std::string lettersPath;
+    std::string corpusPath;
+    std::string matrixPath;
+    int units = 10;
+    int restarts = 8;
+    long iterations = 2000000;
+    unsigned seed = 1;
+};
+
+static void usage() {
+    std::cerr << "Usage: flaporder --letters letters.hpp (--corpus messages.txt [--units N] | --matrix transitions.csv)\n"
+              << "                 [--restarts N] [--iterations N] [--seed N]\n";
+    exit(1);
+}
+
+static Options parseOptions(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            usage();
+
+        std::string value = argv[++i];
+        if (arg == "--letters")
+            options.lettersPath = value;
+        else if (arg == "--corpus")
+            options.corpusPath = value;
+        else if (arg == "--matrix")
+            options.matrixPath = value;
+        else if (arg == "--units")
+            options.units = atoi(value.c_str());
+        else if (arg == "--restarts")
+            options.restarts = atoi(value.c_str());
+        else if (arg == "--iterations")
+            options.iterations = atol(value.c_str());
+        else if (arg == "--seed")
+            options.seed = (unsigned)strtoul(value.c_str(), NULL, 10);
+        else
+            usage();
+    }
+
+    if (options.lettersPath.empty() || options.corpusPath.empty() == options.matrixPath.empty() || options.units <= 0)
+        usage();
+
+    return options;
+}
+
+static std::string readFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Could not open " << path << "\n";
+        exit(1);
+    }
+
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+// Split UTF-8 text into code points
+static std::vector<uint32_t> decodeUtf8(const std::string &text) {
+    std::vector<uint32_t> codePoints;
+    size_t i = 0;
+    while (i < text.size()) {
+        uint8_t c = (uint8_t)text[i];
+        int length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 1;
+        uint32_t codePoint = length == 1 ? c : c & (0xFF >> (length + 1));
+        for (int j = 1; j < length && i + j < text.size(); j++)
+            codePoint = (codePoint << 6) | ((uint8_t)text[i + j] & 0x3F);
+
+        codePoints.push_back(codePoint);
+        i += length;
+    }
+
+    return codePoints;
+}
+
+static std::string encodeUtf8(uint32_t codePoint) {
+    std::string text;
+    if (codePoint < 0x80) {
+        text += (char)codePoint;
+    } else if (codePoint < 0x800) {
+        text += (char)(0xC0 | (codePoint >> 6));
+        text += (char)(0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+        text += (char)(0xE0 | (codePoint >> 12));
+        text += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+        text += (char)(0x80 | (codePoint & 0x3F));
+    } else {
+        text += (char)(0xF0 | (codePoint >> 18));
+        text += (char)(0x80 | ((codePoint >> 12) & 0x3F));
+        text += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+        text += (char)(0x80 | (codePoint & 0x3F));
+    }
+
+    return text;
+}
+
+// Read the flaps from the unitLetters[] initialiser in letters.hpp
+static std::vector<uint32_t> readLetters(const std::string &path) {
+    std::string source = readFile(path);
+    size_t start = source.find("unitLetters[]");
+    start = start == std::string::npos ? start : source.find('{', start);
+    size_t end = start == std::string::npos ? start : source.find("};", start);
+    if (end == std::string::npos) {
+        std::cerr << "Could not find unitLetters[] in " << path << "\n";
+        exit(1);
+    }
+
+    std::vector<uint32_t> letters;
+    std::vector<uint32_t> body = decodeUtf8(source.substr(start + 1, end - start - 1));
+    for (size_t i = 0; i < body.size(); i++) {
+        if (body[i] != '\'')
+            continue;
+
+        uint32_t letter = body[++i];
+        if (letter == '\\')
+            letter = body[++i];
+        letters.push_back(letter);
+        ++i;
+    }
+
+    return letters;
+}
+
+static Flaps findCopies(const std::vector<uint32_t> &letters) {
+    Flaps flaps;
+    flaps.letters = letters;
+    flaps.letterNums.resize(letters.size());
+    flaps.copies.resize(letters.size());
+    for (size_t i = 0; i < letters.size(); i++) {
+        size_t first = 0;
+        while (letters[first] != letters[i])
+            first++;
+
+        flaps.letterNums[i] = (int)first;
+        flaps.copies[first].push_back((int)i);
+    }
+
+    return flaps;
+}
+
+// Map a character to its first flap, upper casing where the flaps only have upper case
+static int findLetter(const std::vector<uint32_t> &letters, uint32_t codePoint) {
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < letters.size(); i++) {
+            if (letters[i] == codePoint)
+                return (int)i;
+        }
+
+        bool lowerCase = (codePoint >= 'a' && codePoint <= 'z') || (codePoint >= 0xE0 && codePoint <= 0xFE && codePoint != 0xF7);
+        if (!lowerCase)
+            break;
+        codePoint -= 0x20;
+    }
+
+    return -1;
+}
+
+// Read messages and pad / truncate to one letter per unit, unsupported characters show the first flap
+static std::vector<std::vector<int>> readCorpus(const Options &options, const std::vector<uint32_t> &letters) {
+    std::ifstream file(options.corpusPath);
+    if (!file) {
+        std::cerr << "Could not open " << options.corpusPath << "\n";
+        exit(1);
+    }
+
+    int blank = findLetter(letters, ' ');
+    int unsupported = 0;
+    std::vector<std::vector<int>> messages;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        std::vector<uint32_t> codePoints = decodeUtf8(line);
+        std::vector<int> message(options.units, blank < 0 ? 0 : blank);
+        for (int unit = 0; unit < options.units && unit < (int)codePoints.size(); unit++) {
+            int letterNum = findLetter(letters, codePoints[unit]);
+            if (letterNum < 0) {
+                ++unsupported;
+                letterNum = 0;
+            }
+            message[unit] = letterNum;
+        }
+
+        messages.push_back(message);
+    }
+
+    if (unsupported > 0)
+        std::cerr << unsupported << " unsupported characters in the corpus were counted as the first flap\n";
+
+    return messages;
+}
+
+static Matrix transitionsFromCorpus(const std::vector<std::vector<int>> &messages, size_t letterCount) {
+    Matrix transitions(letterCount, std::vector<int64_t>(letterCount, 0));
+    for (size_t i = 1; i < messages.size(); i++) {
+        for (size_t unit = 0; unit < messages[i].size(); unit++)
+            ++transitions[messages[i - 1][unit]][messages[i][unit]];
+    }
+
+    return transitions;
+}
+
+// Counts are recorded between the flaps units actually land on, so copies are added to their letter
+static Matrix readMatrix(const std::string &path, const Flaps &flaps) {
+    size_t letterCount = flaps.letters.size();
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Could not open " << path << "\n";
+        exit(1);
+    }
+
+    Matrix transitions;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line == "\r")
+            continue;
+
+        std::vector<int64_t> row;
+        std::stringstream cells(line);
+        std::string cell;
+        while (std::getline(cells, cell, ','))
+            row.push_back(atoll(cell.c_str()));
+
+        if (row.size() != letterCount) {
+            std::cerr << "Matrix row has " << row.size() << " columns, letters.hpp has " << letterCount << " flaps\n";
+            exit(1);
+        }
+        transitions.push_back(row);
+    }
+
+    if (transitions.size() != letterCount) {
+        std::cerr << "Matrix has " << transitions.size() << " rows, letters.hpp has " << letterCount << " flaps\n";
+        exit(1);
+    }
+
+    Matrix letterTransitions(letterCount, std::vector<int64_t>(letterCount, 0));
+    for (size_t from = 0; from < letterCount; from++) {
+        for (size_t to = 0; to < letterCount; to++)
+            letterTransitions[flaps.letterNums[from]][flaps.letterNums[to]] += transitions[from][to];
+    }
+
+    return letterTransitions;
+}
+
+// Flaps to travel forward from one position to another
+static inline int64_t flapsBetween(int from, int to, int count) {
+    return (to - from + count) % count;
+}
+
+// Copy of letterNum a unit at fromFlap goes to, whichever is reached first going forward as the firmware does
+static int nearestCopy(const Flaps &flaps, const std::vector<int> &positions, int fromFlap, int letterNum) {
+    int count = (int)positions.size();
+    int nearest = flaps.copies[letterNum][0];
+    for (int copy : flaps.copies[letterNum]) {
+        if (flapsBetween(positions[fromFlap], positions[copy], count) < flapsBetween(positions[fromFlap], positions[nearest], count))
+            nearest = copy;
+    }
+
+    return nearest;
+}
+
+// Flaps travelled from one letter to another, averaged over the copies of the first the unit could be showing
+static double letterTravel(const Flaps &flaps, const std::vector<int> &positions, int from, int to) {
+    int count = (int)positions.size();
+    int64_t total = 0;
+    for (int fromFlap : flaps.copies[from])
+        total += flapsBetween(positions[fromFlap], positions[nearestCopy(flaps, positions, fromFlap, to)], count);
+
+    return (double)total / (double)flaps.copies[from].size();
+}
+
+// Expected travel in flaps, summed over every transition
+// positions[flap] is where that flap sits on the drum
+static double orderCost(const Matrix &transitions, const Flaps &flaps, const std::vector<int> &positions) {
+    int count = (int)positions.size();
+    double cost = 0;
+    for (int from = 0; from < count; from++) {
+        for (int to = 0; to < count; to++) {
+            if (transitions[from][to] != 0)
+                cost += transitions[from][to] * letterTravel(flaps, positions, from, to);
+        }
+    }
+
+    return cost;
+}
+
+// Cost of every transition to or from either of two letters
+static double lettersCost(const Matrix &transitions, const Flaps &flaps, const std::vector<int> &positions, int letterA, int letterB) {
+    int count = (int)positions.size();
+    double cost = 0;
+    for (int other = 0; other < count; other++) {
+        for (int letter : {letterA, letterB}) {
+            if (transitions[letter][other] != 0)
+                cost += transitions[letter][other] * letterTravel(flaps, positions, letter, other);
+            if (other != letterA && other != letterB && transitions[other][letter] != 0)
+                cost += transitions[other][letter] * letterTravel(flaps, positions, other, letter);
+        }
+    }
+
+    return cost;
+}
+
+// Change in cost from swapping the positions of flaps a and b
+// Only transitions to or from their letters change, and swapping two copies of a letter changes nothing
+static double swapDelta(const Matrix &transitions, const Flaps &flaps, std::vector<int> &positions, int a, int b) {
+    int letterA = flaps.letterNums[a];
+    int letterB = flaps.letterNums[b];
+    if (letterA == letterB)
+        return 0;
+
+    double before = lettersCost(transitions, flaps, positions, letterA, letterB);
+    std::swap(positions[a], positions[b]);
+    double after = lettersCost(transitions, flaps, positions, letterA, letterB);
+    std::swap(positions[a], positions[b]);
+    return after - before;
+}
+
+// Simulated annealing over swaps, flap 0 stays first
+static std::vector<int> optimise(const Matrix &transitions, const Flaps &flaps, const Options &options) {
+    int count = (int)transitions.size();
+    std::mt19937 random(options.seed);
+    std::uniform_int_distribution<int> pickFlap(1, count - 1);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    std::vector<int> best(count);
+    for (int i = 0; i < count; i++)
+        best[i] = i;
+    double bestCost = orderCost(transitions, flaps, best);
+    if (count < 3)
+        return best;
+
+    for (int restart = 0; restart < options.restarts; restart++) {
+        std::vector<int> positions = best;
+        std::shuffle(positions.begin() + 1, positions.end(), random);
+        double cost = orderCost(transitions, flaps, positions);
+
+        // Start hot enough that a typical bad swap is often accepted
+        double meanDelta = 0;
+        for (int i = 0; i < 200; i++)
+            meanDelta += std::abs(swapDelta(transitions, flaps, positions, pickFlap(random), pickFlap(random)));
+        double startTemperature = std::max(meanDelta / 200, 1.0);
+        double endTemperature = 0.01;
+
+        for (long iteration = 0; iteration < options.iterations; iteration++) {
+            int a = pickFlap(random);
+            int b = pickFlap(random);
+            if (a == b)
+                continue;
+
+            double progress = (double)iteration / options.iterations;
+            double temperature = startTemperature * std::pow(endTemperature / startTemperature, progress);
+            double delta = swapDelta(transitions, flaps, positions, a, b);
+            if (delta > 0 && chance(random) >= std::exp(-delta / temperature))
+                continue;
+
+            std::swap(positions[a], positions[b]);
+            cost += delta;
+            if (cost < bestCost) {
+                bestCost = cost;
+                best = positions;
+            }
+        }
+
+        std::cerr << "Search " << restart + 1 << "/" << options.restarts << ": best cost " << std::llround(bestCost) << "\n";
+    }
+
+    return best;
+}
+
+// Average over messages of the furthest any unit travels, which is what decides how long a message takes
+// Each unit is followed onto whichever copy of a repeated letter it lands on
+static double averageMessageFlaps(const std::vector<std::vector<int>> &messages, const Flaps &flaps, const std::vector<int> &positions) {
+    if (messages.size() < 2)
+        return 0;
+
+    // Units start on the first copy round the drum, as they do after homing
+    int count = (int)positions.size();
+    std::vector<int> showing(messages[0].size());
+    for (size_t unit = 0; unit < showing.size(); unit++) {
+        showing[unit] = flaps.copies[messages[0][unit]][0];
+        for (int copy : flaps.copies[messages[0][unit]])
+            showing[unit] = positions[copy] < positions[showing[unit]] ? copy : showing[unit];
+    }
+
+    double total = 0;
+    for (size_t i = 1; i < messages.size(); i++) {
+        int64_t furthest = 0;
+        for (size_t unit = 0; unit < messages[i].size(); unit++) {
+            int flap = nearestCopy(flaps, positions, showing[unit], messages[i][unit]);
+            furthest = std::max(furthest, flapsBetween(positions[showing[unit]], positions[flap], count));
+            showing[unit] = flap;
+        }
+        total += (double)furthest;
+    }
+
+    return total / (double)(messages.size() - 1);
+}
+
+static std::string quoteLetter(uint32_t letter) {
+    if (letter == '\'' || letter == '\\')
+        return std::string("'\\") + (char)letter + "'";
+
+    return "'" + encodeUtf8(letter) + "'";
+}
+
+// Find the initialiser of an array in letters.hpp, start is after the '{' and end is the '}'
+static bool findInitialiser(const std::string &source, const std::string &declaration, size_t &start, size_t &end) {
+    start = source.find(declaration);
+    start = start == std::string::npos ? start : source.find('{', start);
+    end = start == std::string::npos ? start : source.find('}', start);
+    if (end == std::string::npos)
+        return false;
+
+    ++start;
+    return true;
+}
+
+// Print letters.hpp with the new order, keeping everything else including any other flap sets
+// positions[letterNum] is where each original letter moves to
+static void printLettersHpp(const std::string &source, const std::vector<uint32_t> &letters, const std::vector<int> &positions) {
+    std::vector<uint32_t> ordered(letters.size());
+    for (size_t i = 0; i < letters.size(); i++)
+        ordered[positions[i]] = letters[i];
+
+    std::string orderedText;
+    for (size_t i = 0; i < ordered.size(); i++)
+        orderedText += (i == 0 ? "U" : ", U") + quoteLetter(ordered[i]);
+
+    // Calibration letter numbers need to follow their letters
+    std::string calibrationText;
+    size_t calibrationStart, calibrationEnd;
+    bool hasCalibration = findInitialiser(source, "const int calLetters[]", calibrationStart, calibrationEnd);
+    if (hasCalibration) {
+        std::stringstream cells(source.substr(calibrationStart, calibrationEnd - calibrationStart));
+        std::string cell;
+        while (std::getline(cells, cell, ',')) {
+            int letterNum = atoi(cell.c_str());
+            if (letterNum < 0 || letterNum >= (int)positions.size())
+                continue;
+
+            calibrationText += calibrationText.empty() ? "" : ", ";
+            calibrationText += std::to_string(positions[letterNum]);
+        }
+    }
+
+    // Whichever comes last is replaced first, so the other's offsets still hold whatever order they're in
+    size_t lettersStart, lettersEnd;
+    findInitialiser(source, "unitLetters[]", lettersStart, lettersEnd);
+    std::string output = source;
+    if (hasCalibration && calibrationStart > lettersEnd)
+        output.replace(calibrationStart, calibrationEnd - calibrationStart, calibrationText);
+    output.replace(lettersStart, lettersEnd - lettersStart, orderedText);
+    if (hasCalibration && calibrationStart < lettersStart)
+        output.replace(calibrationStart, calibrationEnd - calibrationStart, calibrationText);
+
+#ifdef _WIN32
+    // Text mode would turn each CRLF into CR CR LF
+    fflush(stdout);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    std::cout << output;
+}
+
+int main(int argc, char **argv) {
+    Options options = parseOptions(argc, argv);
+    std::vector<uint32_t> letters = readLetters(options.lettersPath);
+    if (letters.size() < 2) {
+        std::cerr << "Found " << letters.size() << " flaps in " << options.lettersPath << ", need at least 2\n";
+        return 1;
+    }
+
+    Flaps flaps = findCopies(letters);
+    std::vector<std::vector<int>> messages;
+    Matrix transitions;
+    if (!options.corpusPath.empty()) {
+        messages = readCorpus(options, letters);
+        transitions = transitionsFromCorpus(messages, letters.size());
+    } else {
+        transitions = readMatrix(options.matrixPath, flaps);
+    }
+
+    int64_t updates = 0;
+    for (auto &row : transitions) {
+        for (int64_t count : row)
+            updates += count;
+    }
+    if (updates == 0) {
+        std::cerr << "No transitions to optimise for\n";
+        return 1;
+    }
+
+    std::vector<int> current(letters.size());
+    for (size_t i = 0; i < letters.size(); i++)
+        current[i] = (int)i;
+    std::vector<int> optimised = optimise(transitions, flaps, options);
+
+    // Report
+    double currentFlaps = orderCost(transitions, flaps, current) / (double)updates;
+    double optimisedFlaps = orderCost(transitions, flaps, optimised) / (double)updates;
+    fprintf(stderr, "\nUnit updates: %lld\n", (long long)updates);
+    fprintf(stderr, "Expected flaps per unit update: %.2f current, %.2f optimised\n", currentFlaps, optimisedFlaps);
+    if (optimisedFlaps > 0)
+        fprintf(stderr, "Expected speedup per unit update: %.2fx\n", currentFlaps / optimisedFlaps);
+
+    if (!messages.empty()) {
+        double currentMessageFlaps = averageMessageFlaps(messages, flaps, current);
+        double optimisedMessageFlaps = averageMessageFlaps(messages, flaps, optimised);
+        fprintf(stderr, "Flaps per message (furthest unit): %.2f current, %.2f optimised\n", currentMessageFlaps, optimisedMessageFlaps);
+        if (optimisedMessageFlaps > 0)
+            fprintf(stderr, "Expected speedup per message: %.2fx\n", currentMessageFlaps / optimisedMessageFlaps);
+    }
+
+    printLettersHpp(readFile(options.lettersPath), letters, optimised);
+    return 0;
+}
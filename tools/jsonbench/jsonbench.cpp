@@ -0,0 +1,273 @@
+// JSON load test
+//
+// Runs the firmware's JsonReader over request bodies like those the API takes, counting heap allocations and
+// timing each one, so changes to the request path can be checked on the host.
+//
+// Usage:
+//   jsonbench parse [requests]
+//   jsonbench soak [seconds]
+//
+// parse      Parse each sample body the given number of times (default 200000), as WebServer::readJson does,
+//            then read every field. Prints the time and heap used per request
+// soak       Answer GET /api/status polls for the given number of seconds (default 60) with the firmware's own
+//            status writer and cache, a new version every few polls as a busy display would, some from the
+//            cache, some written again and some streamed in chunks. Prints the heap in use every tenth of the run
+//
+// Exits with 1 if parsing or writing allocated anything, a sample didn't parse, or a status didn't write.
+
+#include "jsonreader.hpp"
+#include "jsonwriter.hpp"
+#include "statusjson.hpp"
+#include "glyphs.hpp"
+#include <malloc.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Every allocation goes through these, new included, so anything the code under test allocates is counted
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+}
+
+static size_t allocations = 0;
+static size_t heapBytes = 0;
+static size_t peakHeapBytes = 0;
+
+static void *counted(void *ptr) {
+    if (ptr == nullptr)
+        return ptr;
+
+    allocations++;
+    heapBytes += malloc_usable_size(ptr);
+    if (heapBytes > peakHeapBytes)
+        peakHeapBytes = heapBytes;
+    return ptr;
+}
+
+static void uncounted(void *ptr) {
+    if (ptr != nullptr)
+        heapBytes -= malloc_usable_size(ptr);
+}
+
+extern "C" {
+void *malloc(size_t size) { return counted(__libc_malloc(size)); }
+void *calloc(size_t count, size_t size) { return counted(__libc_calloc(count, size)); }
+void free(void *ptr) { uncounted(ptr); __libc_free(ptr); }
+void *realloc(void *ptr, size_t size) {
+    uncounted(ptr);
+    return counted(__libc_realloc(ptr, size));
+}
+}
+
+typedef struct {
+    size_t allocations;
+    size_t peakHeapBytes;   // Above what was in use when it started
+    double requestNs;
+} Measurement_t;
+
+// Run fn requests times, measuring heap and time
+template<typename Fn>
+static Measurement_t measure(int requests, Fn fn) {
+    size_t startAllocations = allocations;
+    size_t startHeapBytes = heapBytes;
+    peakHeapBytes = heapBytes;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < requests; i++)
+        fn();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    Measurement_t result;
+    result.allocations = allocations - startAllocations;
+    result.peakHeapBytes = peakHeapBytes - startHeapBytes;
+    result.requestNs = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / requests;
+    return result;
+}
+
+// Bodies as clients send them, from a single message up to a full batch
+static const char *sampleBodies[][2] = {
+    {"mode", "{\"mode\": \"CLOCK\"}"},
+    {"message", "{\"message\": \"HOME 2 AWAY 1\", \"minDisplayMs\": 5000, \"key\": \"score\", \"wait\": true}"},
+    {"escaped", "{\"message\": \"caf\\u00e9 \\\"12\\\" \\ud83d\\ude00\", \"showAtMs\": 1760000000000}"},
+    {"calibration", "{\"action\": \"offset\", \"offsets\": [102, 98, 110, 95, 101, 99, 104, 97, 100, 103, 96, 105]}"},
+    {"messages", nullptr},
+};
+
+// A batch of 10 messages, the most POST /api/messages takes at once
+static void buildBatch(char *body, size_t size) {
+    size_t length = snprintf(body, size, "{\"messages\": [");
+    for (int i = 0; i < 10; i++) {
+        length += snprintf(&body[length], size - length, "%s{\"message\": \"DEPARTS %02d:%02d\", \"minDisplayMs\": %d, \"key\": %d}",
+            i > 0 ? ", " : "", 8 + i / 4, (i % 4) * 15, 2000 + i * 100, i + 1);
+    }
+    snprintf(&body[length], size - length, "]}");
+}
+
+// Read every value, as the handlers would, so nothing is left unparsed
+static double readAll(JsonReader &json, int token) {
+    double sum = 0;
+    if (json.isObject(token) || json.isArray(token)) {
+        for (int item = json.getFirst(token); item >= 0; item = json.getNext(item))
+            sum += readAll(json, item);
+    } else if (json.isString(token)) {
+        sum += strlen(json.getString(token));
+    } else {
+        sum += json.getNumber(token) + json.getBool(token);
+    }
+    return sum;
+}
+
+// Same as WebServer, a body buffer that lasts as long as the server
+static const size_t maxBodyLength = 1024 * 8;
+static char body[maxBodyLength + 1];
+static JsonReader json;
+static volatile double sink;
+
+static bool runParse(int requests) {
+    char batch[2048];
+    buildBatch(batch, sizeof(batch));
+    sampleBodies[4][1] = batch;
+
+    bool passed = true;
+    printf("%-12s %6s %12s %12s %12s\n", "body", "bytes", "ns/request", "allocations", "peak heap");
+    for (auto &sample : sampleBodies) {
+        const char *text = sample[1];
+        size_t length = strlen(text);
+
+        // httpd_req_recv copies the body into the buffer, and parsing unescapes it in place
+        Measurement_t result = measure(requests, [&]() {
+            memcpy(body, text, length);
+            body[length] = 0;
+            if (!json.parse(body, length))
+                passed = false;
+            sink = readAll(json, 0);
+        });
+
+        printf("%-12s %6zu %12.0f %12zu %12zu\n", sample[0], length, result.requestNs, result.allocations, result.peakHeapBytes);
+        if (result.allocations > 0)
+            passed = false;
+    }
+
+    if (!passed)
+        printf("FAILED, a sample didn't parse or parsing allocated\n");
+    return passed;
+}
+
+// Stands in for httpd_resp_send_chunk
+static bool sendChunk(void *context, const char *, size_t length) {
+    *(size_t*)context += length;
+    return true;
+}
+
+// A busy display with every unit landed somewhere and a full queue, different for each version
+static void fillState(uint32_t version, DisplayState_t &state, QueuedMessage_t *timeline, size_t timelineCount) {
+    memset(&state, 0, sizeof(state));
+    state.version = version;
+    state.mode = DisplayMode::Text;
+    state.hasMessage = true;
+    state.moving = version & 1;
+    state.queueLength = timelineCount;
+    for (int i = 0; i < CONFIG_UNITS_COUNT; i++) {
+        state.message[i] = (version + i) % unitLettersCount;
+        state.unitGlyphs[i] = i == 0 ? noGlyph : state.message[i];
+        state.unitPositions[i] = (version * 37 + i) % 4096;
+    }
+    state.changedUnits = CONFIG_UNITS_COUNT;
+    state.steps = 2048;
+    state.messagesShown = version;
+    state.messagesUnchanged = version / 7;
+    state.totalSteps = version * 2048ULL;
+
+    for (size_t i = 0; i < timelineCount; i++) {
+        memcpy(timeline[i].message.glyphs, state.message, CONFIG_UNITS_COUNT);
+        timeline[i].message.minShowMs = 5000;
+        timeline[i].eta.startUs = (1760000000000LL + version * 1000LL + i * 6000) * 1000;
+        timeline[i].eta.arrivalUs = timeline[i].eta.startUs + 4000 * 1000;
+    }
+}
+
+// Same as WebServer, the cached status, the queue it's written from and the buffer chunked responses go through
+static StatusCache status;
+static QueuedMessage_t timeline[10];
+static char response[1024];
+
+// Answer a poll the way WebServer::getStatus does once the ETag check has passed, from the cached document if
+// it's for this version, otherwise writing it again, or streaming it if it's too big to keep
+static bool poll(const DisplayState_t &state, bool stream, size_t &length) {
+    if (!stream && status.has(state.version)) {
+        length = status.getLength();
+        return true;
+    }
+
+    if (!stream && status.write(state, timeline, 10)) {
+        length = status.getLength();
+        return true;
+    }
+
+    length = 0;
+    JsonWriter json(response, sizeof(response), sendChunk, &length);
+    writeStatusJson(json, state, timeline, 10);
+    length += json.getLength();
+    return json.ok();
+}
+
+static bool runSoak(int seconds) {
+    // After the first output, so stdout's own buffer isn't counted
+    printf("%8s %12s %12s %12s\n", "seconds", "requests", "allocations", "heap in use");
+    size_t startAllocations = allocations;
+    size_t startHeapBytes = heapBytes;
+    uint32_t version = 0;
+    size_t statusBytes = 0;
+    uint64_t requests = 0;
+    bool passed = true;
+
+    auto start = std::chrono::steady_clock::now();
+    auto runFor = std::chrono::seconds(seconds);
+    DisplayState_t state;
+    int reports = 0;
+    while (reports < 10) {
+        for (int i = 0; i < 1000; i++) {
+            // A new version every few polls, the polls in between are answered from the cache, and every
+            // version is also streamed, as a document too big to keep would be
+            if (requests % 3 == 0)
+                fillState(++version, state, timeline, 10);
+            passed = poll(state, requests % 3 == 2, statusBytes) && passed;
+            requests++;
+        }
+
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed * 10 >= runFor * (reports + 1)) {
+            reports++;
+            printf("%8.1f %12llu %12zu %12zu\n", std::chrono::duration<double>(elapsed).count(), (unsigned long long)requests,
+                allocations - startAllocations, heapBytes);
+        }
+    }
+
+    printf("Status is %zu bytes, heap in use went from %zu to %zu bytes\n", statusBytes, startHeapBytes, heapBytes);
+    if (allocations != startAllocations || heapBytes != startHeapBytes) {
+        printf("FAILED, writing the status allocated\n");
+        passed = false;
+    } else if (!passed) {
+        printf("FAILED, a status didn't fit or didn't flush\n");
+    }
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "parse") == 0) {
+        int requests = argc > 2 ? atoi(argv[2]) : 200000;
+        return runParse(requests > 0 ? requests : 1) ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "soak") == 0) {
+        int seconds = argc > 2 ? atoi(argv[2]) : 60;
+        return runSoak(seconds > 0 ? seconds : 1) ? 0 : 1;
+    }
+
+    fprintf(stderr, "Usage: jsonbench parse [requests] | soak [seconds]\n");
+    return 2;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Just what the JSON and glyph code reads, as for a 12 unit display
+#define CONFIG_UNITS_COUNT 12
+#define CONFIG_UNITS_FLAP_SETS ""
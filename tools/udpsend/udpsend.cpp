@@ -0,0 +1,321 @@
+// UDP message sender
+//
+// Sends message frames to a display with CONFIG_UDP_INGEST enabled, see main/udpframe.hpp for the format.
+//
+// Usage:
+//   udpsend --host splitflap.local --text "HOME 2 AWAY 1"
+//   udpsend --host 192.168.1.50 --glyphs 7,4,11,11,14 --key 1 --priority 1
+//   udpsend --host 192.168.1.50 --text "TICK %d" --repeat 100 --interval 250
+//   udpsend --self-test
+//
+// --host     Display to send to
+// --port     UDP port (default 5005, CONFIG_UDP_INGEST_PORT)
+// --text     UTF-8 text, with --repeat any %d is replaced by the frame number
+// --glyphs   Comma separated glyph for each unit, their index in unitLetters in the display's letters.hpp
+// --flaps    Comma separated flap number for each unit, on each unit's own drum
+// --hold     Minimum display time in milliseconds (default 0)
+// --key      Coalescing key, queued frames with the same key replace each other (default 0, never)
+// --priority Queued ahead of frames with a lower priority (default 0)
+// --seq      Sequence number of the first frame (default the time in milliseconds, so restarts keep going up)
+// --reset    Mark the first frame as restarting the sequence, so the display accepts it whatever went before
+// --repeat   Number of frames to send, with increasing sequence numbers (default 1)
+// --interval Milliseconds between repeated frames (default 1000)
+//
+// --self-test sends frames to itself over loopback and checks they decode, and that stale ones are dropped,
+// exiting with 0 if they all pass.
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <netdb.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "udpframe.hpp"
+
+struct Options {
+    std::string host;
+    int port = 5005;
+    UdpPayload payloadType = UdpPayload::Text;
+    std::string payload;
+    bool hasPayload = false;
+    int hold = 0;
+    uint32_t key = 0;
+    int priority = 0;
+    uint32_t sequence = 0;
+    bool hasSequence = false;
+    bool reset = false;
+    int repeat = 1;
+    int interval = 1000;
+    bool selfTest = false;
+};
+
+static void usage() {
+    std::cerr << "Usage: udpsend --host HOST [--port N] (--text TEXT | --glyphs N,N,... | --flaps N,N,...)\n"
+              << "               [--hold MS] [--key N] [--priority N] [--seq N] [--reset] [--repeat N] [--interval MS]\n"
+              << "       udpsend --self-test\n";
+    exit(1);
+}
+
+// Turn "1,2,3" into a byte per unit
+static std::string parseList(const std::string &list) {
+    std::string bytes;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+
+        int value = atoi(list.substr(start, end - start).c_str());
+        if (value < 0 || value > 255)
+            usage();
+        bytes += (char)value;
+        start = end + 1;
+    }
+    return bytes;
+}
+
+static Options parseOptions(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--self-test") {
+            options.selfTest = true;
+            continue;
+        }
+        if (arg == "--reset") {
+            options.reset = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+            usage();
+
+        std::string value = argv[++i];
+        if (arg == "--host") {
+            options.host = value;
+        } else if (arg == "--port") {
+            options.port = atoi(value.c_str());
+        } else if (arg == "--text") {
+            options.payloadType = UdpPayload::Text;
+            options.payload = value;
+            options.hasPayload = true;
+        } else if (arg == "--glyphs" || arg == "--flaps") {
+            options.payloadType = arg == "--glyphs" ? UdpPayload::Glyphs : UdpPayload::Flaps;
+            options.payload = parseList(value);
+            options.hasPayload = true;
+        } else if (arg == "--hold") {
+            options.hold = atoi(value.c_str());
+        } else if (arg == "--key") {
+            options.key = (uint32_t)strtoul(value.c_str(), NULL, 10);
+        } else if (arg == "--priority") {
+            options.priority = atoi(value.c_str());
+        } else if (arg == "--seq") {
+            options.sequence = (uint32_t)strtoul(value.c_str(), NULL, 10);
+            options.hasSequence = true;
+        } else if (arg == "--repeat") {
+            options.repeat = atoi(value.c_str());
+        } else if (arg == "--interval") {
+            options.interval = atoi(value.c_str());
+        } else {
+            usage();
+        }
+    }
+
+    if (options.selfTest)
+        return options;
+
+    if (options.host.empty() || !options.hasPayload || options.port <= 0 || options.port > 65535 || options.repeat <= 0)
+        usage();
+    if (options.hold < 0 || options.hold > 65535 || options.priority < 0 || options.priority > 255)
+        usage();
+    if (options.payload.size() > udpFrameMaxPayloadLength) {
+        std::cerr << "Payload is longer than " << udpFrameMaxPayloadLength << " bytes\n";
+        exit(1);
+    }
+
+    return options;
+}
+
+static UdpFrame_t makeFrame(UdpPayload payloadType, const std::string &payload, uint32_t sequence) {
+    UdpFrame_t frame = {};
+    frame.payloadType = payloadType;
+    frame.sequence = sequence;
+    frame.payloadLength = (uint8_t)payload.size();
+    frame.payload = (const uint8_t *)payload.data();
+    return frame;
+}
+
+static int send(const Options &options) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo *address;
+    if (getaddrinfo(options.host.c_str(), std::to_string(options.port).c_str(), &hints, &address) != 0) {
+        std::cerr << "Could not resolve " << options.host << "\n";
+        return 1;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        std::cerr << "Could not create socket\n";
+        freeaddrinfo(address);
+        return 1;
+    }
+
+    uint32_t sequence = options.sequence;
+    if (!options.hasSequence) {
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        sequence = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+    }
+
+    int result = 0;
+    for (int i = 0; i < options.repeat; i++) {
+        std::string payload = options.payload;
+        size_t counter = payload.find("%d");
+        if (options.payloadType == UdpPayload::Text && options.repeat > 1 && counter != std::string::npos)
+            payload.replace(counter, 2, std::to_string(i));
+        if (payload.size() > udpFrameMaxPayloadLength)
+            payload.resize(udpFrameMaxPayloadLength);
+
+        UdpFrame_t frame = makeFrame(options.payloadType, payload, sequence + i);
+        frame.coalesceKey = options.key;
+        frame.minDisplayMs = (uint16_t)options.hold;
+        frame.priority = (uint8_t)options.priority;
+        frame.flags = options.reset && i == 0 ? UDP_FRAME_RESET : 0;
+
+        uint8_t buffer[udpFrameMaxLength];
+        size_t length = encodeUdpFrame(frame, buffer);
+        if (sendto(sock, buffer, length, 0, address->ai_addr, address->ai_addrlen) != (ssize_t)length) {
+            std::cerr << "Send failed\n";
+            result = 1;
+            break;
+        }
+
+        if (i + 1 < options.repeat)
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.interval));
+    }
+
+    std::cerr << "Sent " << options.repeat << " frame(s) from sequence " << sequence << "\n";
+    close(sock);
+    freeaddrinfo(address);
+    return result;
+}
+
+static int selfTest() {
+    // Receiver on an ephemeral loopback port, frames go through the real network stack both ways
+    int receiver = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    int sender = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addressLength = sizeof(address);
+    if (receiver < 0 || sender < 0 || bind(receiver, (sockaddr *)&address, sizeof(address)) < 0 ||
+        getsockname(receiver, (sockaddr *)&address, &addressLength) < 0) {
+        std::cerr << "Could not open loopback sockets\n";
+        return 1;
+    }
+
+    timeval timeout = {1, 0};
+    setsockopt(receiver, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    typedef struct {
+        const char *name;
+        std::vector<uint8_t> data;
+        bool valid;
+        bool accepted;
+    } Case_t;
+
+    auto frame = [](UdpPayload payloadType, const std::string &payload, uint32_t sequence, uint8_t flags) {
+        UdpFrame_t frame = makeFrame(payloadType, payload, sequence);
+        frame.coalesceKey = 0xDEADBEEF;
+        frame.minDisplayMs = 1500;
+        frame.priority = 2;
+        frame.flags = flags;
+        std::vector<uint8_t> data(udpFrameMaxLength);
+        data.resize(encodeUdpFrame(frame, data.data()));
+        return data;
+    };
+
+    std::vector<Case_t> cases = {
+        {"text", frame(UdpPayload::Text, "HELLO", 10, 0), true, true},
+        {"newer glyphs", frame(UdpPayload::Glyphs, std::string("\x07\x04\x0b", 3), 11, 0), true, true},
+        {"duplicate", frame(UdpPayload::Text, "HELLO", 11, 0), true, false},
+        {"out of order", frame(UdpPayload::Text, "OLD", 9, 0), true, false},
+        {"gap", frame(UdpPayload::Flaps, std::string("\x01\x02", 2), 20, 0), true, true},
+        {"reset", frame(UdpPayload::Text, "RESTART", 1, UDP_FRAME_RESET), true, true},
+        {"after reset", frame(UdpPayload::Text, "NEXT", 2, 0), true, true},
+        {"wrapped", frame(UdpPayload::Text, "WRAP", 0xFFFFFFF0, UDP_FRAME_RESET), true, true},
+        {"past wrap", frame(UdpPayload::Text, "WRAPPED", 5, 0), true, true},
+        {"bad magic", {'X', 'F', udpFrameVersion, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, false, false},
+        {"short", {'S', 'F', udpFrameVersion, 0}, false, false},
+    };
+
+    std::vector<uint8_t> badVersion = frame(UdpPayload::Text, "V2", 30, 0);
+    badVersion[2] = udpFrameVersion + 1;
+    cases.push_back({"unknown version", badVersion, false, false});
+
+    std::vector<uint8_t> badLength = frame(UdpPayload::Text, "LONG", 31, 0);
+    badLength.push_back('!');
+    cases.push_back({"trailing bytes", badLength, false, false});
+
+    UdpSequenceFilter filter;
+    int failures = 0;
+    int64_t nowUs = 1;
+    for (auto &test : cases) {
+        sendto(sender, test.data.data(), test.data.size(), 0, (sockaddr *)&address, sizeof(address));
+
+        uint8_t received[udpFrameMaxLength + 1];
+        sockaddr_in from = {};
+        socklen_t fromLength = sizeof(from);
+        ssize_t length = recvfrom(receiver, received, sizeof(received), 0, (sockaddr *)&from, &fromLength);
+        if (length < 0) {
+            std::cerr << "FAIL " << test.name << ": nothing received\n";
+            failures++;
+            continue;
+        }
+
+        // Same as the firmware, see UdpIngest::worker
+        UdpFrame_t decoded;
+        uint64_t senderId = ((uint64_t)from.sin_addr.s_addr << 16) | from.sin_port;
+        bool valid = decodeUdpFrame(received, length, decoded);
+        bool accepted = valid && filter.accept(senderId, decoded.sequence, decoded.flags & UDP_FRAME_RESET, nowUs++);
+        bool fieldsOk = !valid || (decoded.coalesceKey == 0xDEADBEEF && decoded.minDisplayMs == 1500 && decoded.priority == 2 &&
+            memcmp(decoded.payload, &test.data[udpFrameHeaderLength], decoded.payloadLength) == 0);
+
+        bool pass = valid == test.valid && accepted == test.accepted && fieldsOk;
+        std::cerr << (pass ? "PASS " : "FAIL ") << test.name << "\n";
+        if (!pass)
+            failures++;
+    }
+
+    // A sender that's been quiet long enough is forgotten, so an old sequence is taken again
+    bool forgotten = filter.accept(1, 100, false, nowUs) && filter.accept(1, 50, false, nowUs + UdpSequenceFilter::senderTimeoutUs);
+    std::cerr << (forgotten ? "PASS " : "FAIL ") << "sender timeout\n";
+    if (!forgotten)
+        failures++;
+
+    close(sender);
+    close(receiver);
+
+    if (failures > 0) {
+        std::cerr << failures << " failed\n";
+        return 1;
+    }
+
+    std::cerr << "All passed\n";
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    Options options = parseOptions(argc, argv);
+    if (options.selfTest)
+        return selfTest();
+
+    return send(options);
+}